@@ -0,0 +1,527 @@
+#define LOG_LEVEL LOG_LEVEL_OFF
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "ecs.h"
+#include "systems.h"
+#include "snapshot.h"
+#include "world.h"
+#include "hierarchy.h"
+#include "frame_state.h"
+#include "recording.h"
+
+// Benchmarks of the ECS internals, results are written to stdout as CSV or, given --json, as a JSON array. Given
+// --json=path the JSON array goes to that file as well, so one run gives both.
+
+struct Result {
+	std::string benchmark;
+	std::string storage;
+	size_t entities;
+	std::string param;
+	size_t ops;
+	double nsPerOp;
+};
+
+std::vector<Result> results;
+// Set by a benchmark whose result disagrees with its reference, the run then exits non-zero
+bool failed = false;
+
+char const* storageName(Storage storage) {
+	return storage == Storage::Archetype ? "archetype" : "pool";
+}
+
+// Runs fn(), which performs ops operations, until at least minMillis have passed and records the mean
+template<typename F>
+void measure(std::string const& benchmark, Storage storage, size_t entities, std::string const& param, size_t ops, F fn, double minMillis = 200) {
+	size_t runs = 0;
+	auto start = std::chrono::steady_clock::now();
+	double elapsed = 0;
+	do {
+		fn();
+		runs++;
+		elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < minMillis * 1e6);
+	results.push_back(Result{benchmark, storageName(storage), entities, param, runs * ops, elapsed / (runs * ops)});
+	std::cerr << benchmark << " " << storageName(storage) << " " << entities << " " << param << ": " << elapsed / (runs * ops) << "ns/op\n";
+}
+
+Prefab lordPrefab() {
+	Prefab lord("Lord");
+	lord.with(Position{0, 0, 0})
+		.with(Velocity{1, 1, 0})
+		.with(Acceleration{0.1, 0.1, 0})
+		.with(Size{10, 10, 10})
+		.with(Physical{1})
+		.with(Shape{255, 0, 0});
+	return lord;
+}
+
+void benchChurn(Storage storage, size_t n) {
+	Entities entities;
+	Components components(storage);
+	std::vector<EntityId> ids;
+	for(size_t i = 0; i < n; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{0, 0, 0});
+		components.assign(e, Velocity{1, 1, 0});
+		ids.push_back(e.id);
+	}
+	size_t next = 0;
+	measure("churn", storage, n, "remove+create", 1000, [&] {
+		for(size_t i = 0; i < 1000; i++) {
+			size_t slot = next++ % ids.size();
+			Entity* e = entities.find(ids[slot]);
+			components.remove(*e);
+			entities.remove(e->id);
+			Entity& ne = entities.create();
+			components.assign(ne, Position{0, 0, 0});
+			components.assign(ne, Velocity{1, 1, 0});
+			ids[slot] = ne.id;
+		}
+	});
+}
+
+void benchAssignGet(Storage storage, size_t n) {
+	Entities entities;
+	Components components(storage);
+	for(size_t i = 0; i < n; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{0, 0, 0});
+	}
+	measure("assign", storage, n, "Velocity", n, [&] {
+		for(Entity const& c : entities.list()) {
+			Entity& e = *entities.find(c.id);
+			components.assign(e, Velocity{1, 1, 0});
+		}
+	});
+	Z sum = 0;
+	measure("get", storage, n, "Position", n, [&] {
+		for(Entity const& e : entities.list()) {
+			sum += components.get<Position>(e)->pos.x;
+		}
+	});
+	if (sum != 0) {
+		std::cerr << "unexpected sum\n";
+	}
+}
+
+void benchView(Storage storage, size_t n, size_t percent) {
+	Entities entities;
+	Components components(storage);
+	for(size_t i = 0; i < n; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{0, 0, 0});
+		if (i % 100 < percent) {
+			components.assign(e, Velocity{1, 1, 0});
+		}
+	}
+	Tag signature = tag<Position>() | tag<Velocity>();
+	std::string density = std::to_string(percent) + "%";
+	measure("view_scan", storage, n, density, n, [&] {
+		for(Entity& e : entities.view(signature)) {
+			components.get<Position>(e)->pos.x += components.get<Velocity>(e)->vel.x;
+		}
+	});
+	measure("view_typed", storage, n, density, n, [&] {
+		entities.view<Position, Velocity>(components).each([](Entity&, Position& p, Velocity& v) {
+			p.pos.x += v.vel.x;
+		});
+	});
+	measure("view_runs", storage, n, density, n, [&] {
+		entities.view<Position, Velocity>(components).runs([](size_t count, Position* p, Velocity* v) {
+			addScaledVec3(&p->pos, &v->vel, count, 1, PLANAR);
+		});
+	});
+	measure("view_select", storage, n, density, n, [&] {
+		entities.select<Position, Velocity>(components).each([](Entity&, Position& p, Velocity& v) {
+			p.pos.x += v.vel.x;
+		});
+	});
+}
+
+// Finding the entities of a signature, one entity at a time against the simd kernel over the packed signatures
+void benchSignatureMatch(size_t n) {
+	Entities entities;
+	Components components;
+	for(size_t i = 0; i < n; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{0, 0, 0});
+		if (i % 2 == 0) {
+			components.assign(e, Velocity{1, 1, 0});
+		}
+	}
+	Tag signature = tag<Position>() | tag<Velocity>();
+	std::string width = std::to_string(Tag::BITS) + " bits";
+	size_t found = 0;
+	measure("signature_match", Storage::Pool, n, width + " per entity", n, [&] {
+		for(Entity const& e : entities.list()) {
+			found += e.isValid() && (e.components & signature) == signature;
+		}
+	});
+	measure("signature_match", Storage::Pool, n, width + " " + simd().name, n, [&] {
+		found += entities.scan(signature).count;
+	});
+	if (found == 0) {
+		std::cerr << "nothing matched\n";
+	}
+}
+
+// The statically typed world over the same data as benchView, it always uses pool storage
+void benchWorld(size_t n, size_t percent) {
+	World<Position, Velocity> world;
+	for(size_t i = 0; i < n; i++) {
+		Entity& e = world.create();
+		world.assign(e, Position{0, 0, 0});
+		if (i % 100 < percent) {
+			world.assign(e, Velocity{1, 1, 0});
+		}
+	}
+	measure("world_each", Storage::Pool, n, std::to_string(percent) + "%", n, [&] {
+		world.each<Position, Velocity>([](Entity&, Position& p, Velocity& v) {
+			p.pos.x += v.vel.x;
+		});
+	});
+}
+
+// Scans after removing 90% of the entities at random, then again once compacted
+void benchFragmented(Storage storage, size_t n) {
+	Entities entities;
+	Components components(storage);
+	entities.createMany(components, lordPrefab(), n);
+	for(size_t i = 0; i < n; i++) {
+		if (rand() % 10 != 0) {
+			Entity& e = *entities.find(EntityId{i, 0});
+			components.remove(e);
+			entities.remove(e.id);
+		}
+	}
+	Tag signature = tag<Position>() | tag<Velocity>();
+	size_t alive = entities.alive().count;
+	auto scan = [&] {
+		for(Entity& e : entities.view(signature)) {
+			components.get<Position>(e)->pos.x += components.get<Velocity>(e)->vel.x;
+		}
+	};
+	measure("view_scan", storage, n, "10% alive", alive, scan);
+	measure("compact", storage, n, "10% alive", alive, [&] {
+		entities.compact(components);
+	}, 0);
+	components.trim();
+	measure("view_scan", storage, n, "10% alive compacted", alive, scan);
+}
+
+// Spreads the entities over a square in the xy plane sized so each overlaps about one other
+void scatter(Entities& entities, Components& components) {
+	Z side = std::sqrt((Z)entities.size()) * 25;
+	entities.view<Position>(components).each([&](Entity&, Position& p) {
+		p.pos = Vec3{side * rand() / RAND_MAX, side * rand() / RAND_MAX, 0};
+	});
+}
+
+void benchFrame(Storage storage, size_t n, bool profiled) {
+	Entities entities;
+	Components components(storage);
+	Systems systems;
+	systems.add(new TrackPositionSystem);
+	systems.add(new AccelerateSystem);
+	systems.add(new MoveSystem);
+	systems.add(new CollisionSystem);
+	systems.add(new RenderSystem);
+	entities.createMany(components, lordPrefab(), n);
+	scatter(entities, components);
+	profiler().enable(profiled);
+	measure("frame", storage, n, profiled ? "profiled" : "systems", 1, [&] {
+		systems.update(entities, components);
+	});
+	profiler().enable(false);
+	profiler().clear();
+}
+
+size_t bruteForcePairs(Entities& entities, Components& components) {
+	std::vector<Aabb> boxes;
+	entities.view<Position, Physical, Size>(components).each([&](Entity&, Position& p, Physical&, Size& sz) {
+		boxes.push_back(Aabb::around(p.pos, sz.size));
+	});
+	size_t pairs = 0;
+	for(size_t i = 0; i < boxes.size(); i++) {
+		for(size_t j = i + 1; j < boxes.size(); j++) {
+			pairs += boxes[i].overlaps(boxes[j]);
+		}
+	}
+	return pairs;
+}
+
+void benchCollision(Storage storage, size_t n) {
+	Entities entities;
+	Components components(storage);
+	entities.createMany(components, lordPrefab(), n);
+	scatter(entities, components);
+	size_t brutePairs = 0;
+	if (n <= 10000) {
+		measure("collision", storage, n, "brute force", 1, [&] {
+			brutePairs = bruteForcePairs(entities, components);
+		});
+	}
+	size_t gridPairs = 0;
+	measure("collision", storage, n, "grid build", 1, [&] {
+		CollisionSystem collision;
+		collision.updateAll(entities, components);
+		gridPairs = collision.pairs.size();
+	});
+	if (n <= 10000 && brutePairs != gridPairs) {
+		std::cerr << "grid found " << gridPairs << " pairs, brute force " << brutePairs << "\n";
+		failed = true;
+	}
+	// Afterwards only the moved entities are revisited
+	CollisionSystem collision;
+	collision.thisRun = components.advance();
+	collision.updateAll(entities, components);
+	EntityList const& list = entities.list();
+	measure("collision", storage, n, "grid 1% moved", 1, [&] {
+		collision.lastRun = collision.thisRun;
+		collision.thisRun = components.advance();
+		for(size_t i = 0; i < n / 100; i++) {
+			components.write<Position>(list[rand() % n])->pos.x += 1;
+		}
+		collision.updateAll(entities, components);
+	});
+}
+
+// Propagates positions down a tree of n entities, each attached to a random earlier one
+void benchHierarchy(Storage storage, size_t n) {
+	Entities entities;
+	Components components(storage);
+	Hierarchy hierarchy;
+	std::vector<EntityId> ids;
+	for(size_t i = 0; i < n; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{0, 0, 0});
+		components.assign(e, LocalPosition{1, 0, 0});
+		ids.push_back(e.id);
+		if (i > 0) {
+			hierarchy.attach(e.id, ids[rand() % i]);
+		}
+	}
+	hierarchy.update(entities);
+	measure("propagate", storage, n, std::to_string(hierarchy.depth()) + " deep", n, [&] {
+		hierarchy.propagate(entities, components);
+	});
+}
+
+// Publishes Position and Shape of n entities for another thread after percent of the positions changed
+void benchPublish(Storage storage, size_t n, size_t percent) {
+	Entities entities;
+	Components components(storage);
+	entities.createMany(components, lordPrefab(), n);
+	FrameStates<Position, Shape> published;
+	for(int i = 0; i < 3; i++) {
+		published.publish(entities, components);
+	}
+	measure("publish", storage, n, std::to_string(percent) + "% changed", n, [&] {
+		for(EntityIndex i = 0; i < n; i += 100) {
+			for(EntityIndex j = i; j < std::min(n, i + percent); j++) {
+				components.write<Position>(entities.list()[j])->pos.x += 1;
+			}
+		}
+		published.publish(entities, components);
+	});
+}
+
+// Records a frame with percent of the entities moved, then rebuilds the world at the last frame recorded, the
+// farthest a frame gets from its keyframe
+void benchRecord(Storage storage, size_t n, size_t percent) {
+	std::string path = "bench.record";
+	{
+		Entities entities;
+		Components components(storage);
+		entities.createMany(components, lordPrefab(), n);
+		Recorder recorder(path, 0);
+		measure("record", storage, n, std::to_string(percent) + "% changed", n, [&] {
+			for(EntityIndex i = 0; i < n; i += 100) {
+				for(EntityIndex j = i; j < std::min(n, i + percent); j++) {
+					components.write<Position>(entities.list()[j])->pos.x += 1;
+				}
+			}
+			recorder.record(entities, components);
+		});
+		while (recorder.frame % KEYFRAME_INTERVAL != 0) {
+			recorder.record(entities, components);
+		}
+		recorder.record(entities, components);
+		for(size_t f = 1; f < KEYFRAME_INTERVAL; f++) {
+			for(EntityIndex i = 0; i < n; i += 100) {
+				for(EntityIndex j = i; j < std::min(n, i + percent); j++) {
+					components.write<Position>(entities.list()[j])->pos.x += 1;
+				}
+			}
+			recorder.record(entities, components);
+		}
+	}
+	Replay replay;
+	replay.open(path);
+	measure("replay", storage, n, std::to_string(percent) + "% changed", 1, [&] {
+		Entities entities;
+		Components components(storage);
+		replay.load(replay.frames.size() - 1, entities, components);
+	});
+	unlink(path.c_str());
+}
+
+// Rasterizes n shapes into a large framebuffer, then presents frames with 1% of them moved and whole frames
+void benchRender(Storage storage, size_t n) {
+	Entities entities;
+	Components components(storage);
+	Prefab lord = lordPrefab();
+	entities.createMany(components, lord, n);
+	Random random(1);
+	entities.view<Position>(components).each([&](Entity&, Position& p) {
+		p.pos = Vec3{(Z)random.below(3200) - 1600, (Z)random.below(2000) - 1000, 0};
+	});
+	RenderSystem render;
+	render.framebuffer.resize(320, 100);
+	measure("render", storage, n, "320x100", n, [&] {
+		render.updateAll(entities, components);
+	});
+	int devnull = open("/dev/null", O_WRONLY);
+	TerminalWriter terminal(devnull);
+	terminal.present(render.framebuffer);
+	measure("present", storage, n, "1% moved", 1, [&] {
+		for(EntityIndex i = 0; i < n; i += 100) {
+			components.get<Position>(entities.list()[i])->pos.x += 10;
+		}
+		render.updateAll(entities, components);
+		terminal.present(render.framebuffer);
+	});
+	measure("present", storage, n, "full", 1, [&] {
+		terminal.invalidate();
+		terminal.present(render.framebuffer);
+	});
+	close(devnull);
+}
+
+// Reserves n ids spread over threads, half of them reusing removed indexes, and flushes them, no components involved
+void benchReserve(size_t n, size_t threads) {
+	measure("reserve", Storage::Pool, n, std::to_string(threads) + " threads", n, [&] {
+		Entities entities;
+		for(size_t i = 0; i < n / 2; i++) {
+			entities.remove(entities.create().id);
+		}
+		entities.flush();
+		std::vector<std::thread> reserving;
+		for(size_t t = 0; t < threads; t++) {
+			reserving.emplace_back([&] {
+				for(size_t i = 0; i < n / threads; i++) {
+					entities.reserve();
+				}
+			});
+		}
+		for(std::thread& thread : reserving) {
+			thread.join();
+		}
+		entities.flush();
+	});
+}
+
+void benchCreateMany(Storage storage, size_t n) {
+	Prefab lord = lordPrefab();
+	measure("create_many", storage, n, "Lord", n, [&] {
+		Entities entities;
+		Components components(storage);
+		entities.createMany(components, lord, n);
+	});
+}
+
+void benchSnapshot(Storage storage, size_t n) {
+	std::string path = "bench.snapshot";
+	{
+		Entities entities;
+		Components components(storage);
+		entities.createMany(components, lordPrefab(), n);
+		measure("snapshot_save", storage, n, "Lord", 1, [&] {
+			saveSnapshot(path, entities, components);
+		});
+	}
+	measure("snapshot_load", storage, n, "Lord", 1, [&] {
+		Entities entities;
+		Components components(storage);
+		loadSnapshot(path, entities, components);
+	});
+	unlink(path.c_str());
+}
+
+void writeCsv(std::ostream& os) {
+	os << "benchmark,storage,entities,param,ops,ns_per_op\n";
+	for(Result const& r : results) {
+		os << r.benchmark << "," << r.storage << "," << r.entities << "," << r.param << "," << r.ops << "," << r.nsPerOp << "\n";
+	}
+}
+
+void writeJson(std::ostream& os) {
+	os << "[\n";
+	for(size_t i = 0; i < results.size(); i++) {
+		Result const& r = results[i];
+		os << "  {\"benchmark\": \"" << r.benchmark << "\", \"storage\": \"" << r.storage << "\", \"entities\": " << r.entities
+			<< ", \"param\": \"" << r.param << "\", \"ops\": " << r.ops << ", \"ns_per_op\": " << r.nsPerOp << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	os << "]\n";
+}
+
+int main(int argc, char** argv) {
+	std::string arg = argc > 1 ? argv[1] : "";
+	bool json = arg == "--json";
+	std::string jsonPath = arg.rfind("--json=", 0) == 0 ? arg.substr(7) : "";
+	std::cerr << "simd " << simd().name << ", " << ThreadPool::global().size() << " threads\n";
+	benchSignatureMatch(1000000);
+	for(size_t percent : {1, 50, 100}) {
+		benchWorld(100000, percent);
+	}
+	for(size_t threads : {1, 4}) {
+		benchReserve(100000, threads);
+	}
+	for(Storage storage : {Storage::Pool, Storage::Archetype}) {
+		benchChurn(storage, 100000);
+		benchAssignGet(storage, 100000);
+		for(size_t percent : {1, 50, 100}) {
+			benchView(storage, 100000, percent);
+		}
+		benchCreateMany(storage, 100000);
+		benchFragmented(storage, 1000000);
+		benchSnapshot(storage, 1000000);
+		for(size_t n : {1000, 10000, 100000}) {
+			benchCollision(storage, n);
+		}
+		benchHierarchy(storage, 100000);
+		for(size_t percent : {1, 100}) {
+			benchPublish(storage, 1000000, percent);
+		}
+		for(size_t percent : {1, 100}) {
+			benchRecord(storage, 100000, percent);
+		}
+		for(size_t n : {1000, 100000}) {
+			benchRender(storage, n);
+		}
+		for(size_t n : {1000, 100000, 1000000}) {
+			benchFrame(storage, n, false);
+			benchFrame(storage, n, true);
+		}
+	}
+	if (json) {
+		writeJson(std::cout);
+	} else {
+		writeCsv(std::cout);
+	}
+	if (!jsonPath.empty()) {
+		std::ofstream file(jsonPath);
+		writeJson(file);
+		if (!file) {
+			std::cerr << "Could not write " << jsonPath << "\n";
+			return 1;
+		}
+	}
+	return failed ? 1 : 0;
+}
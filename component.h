@@ -4,7 +4,12 @@
 
 #include "ansi_code.h"
 
+// Define ECS_FLOAT to store scalars in single precision, fitting twice the components per cache line and vector
+#ifdef ECS_FLOAT
+typedef float Z;
+#else
 typedef double Z;
+#endif
 
 struct Vec3 { Z x, y, z; };
 struct Color { uint8_t r, g, b; };
@@ -16,6 +21,14 @@ struct Position {
 std::ostream &operator<<(std::ostream &os, Position const& m) { return os << ANSI_FG_YELLOW << "Position{" << m.pos.x << " " << m.pos.y << " " << m.pos.z << "}" << ANSI_RESET; }
 std::string Position::NAME = "Position";
 
+// Position relative to the parent in a Hierarchy, the Position of a child is derived from it
+struct LocalPosition {
+	Vec3 pos;
+	static std::string NAME;
+};
+std::ostream &operator<<(std::ostream &os, LocalPosition const& m) { return os << ANSI_FG_YELLOW << "LocalPosition{" << m.pos.x << " " << m.pos.y << " " << m.pos.z << "}" << ANSI_RESET; }
+std::string LocalPosition::NAME = "LocalPosition";
+
 struct Velocity {
 	Vec3 vel;
 	static std::string NAME;
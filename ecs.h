@@ -0,0 +1,2447 @@
+#pragma once
+// Heavy inspiration from https://www.david-colson.com/2020/02/09/making-a-simple-ecs.html
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <string_view>
+#include <cstring>
+#include <unordered_map>
+#include <tuple>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+
+#include "ansi_code.h"
+#include "component.h"
+#include "thread_pool.h"
+#include "signature.h"
+#include "simd.h"
+#include "log.h"
+#include "profiler.h"
+
+std::string newStr = std::string(ANSI_FG_RED) + "new " + ANSI_RESET;
+std::string assignStr = std::string(ANSI_FG_GRAY) + "assign " + ANSI_RESET;
+
+typedef size_t ComponentId;
+std::atomic<ComponentId> COMPONENT_ID(0);
+const ComponentId INVALID_COMPONENT_ID(-1);
+
+// Name and size of every component id handed out, indexed by id
+struct ComponentInfo {
+	std::string name;
+	size_t size;
+};
+
+std::vector<ComponentInfo> componentInfos;
+std::mutex componentInfosMutex;
+
+// A name that is already registered, e.g. by loading a snapshot, keeps its id
+ComponentId registerComponent(std::string const& name, size_t size) {
+	std::lock_guard<std::mutex> lock(componentInfosMutex);
+	for(ComponentId i = 0; i < componentInfos.size(); i++) {
+		if (componentInfos[i].name == name) {
+			if (componentInfos[i].size != size) {
+				fprintf(stderr, "Component %s registered with size %zu and %zu\n", name.c_str(), componentInfos[i].size, size);
+				abort();
+			}
+			return i;
+		}
+	}
+	ComponentId i = COMPONENT_ID++;
+	if (i >= Tag::BITS) {
+		fprintf(stderr, "Component %s does not fit in a signature of %zu components, raise ECS_SIGNATURE_BITS\n", name.c_str(), Tag::BITS);
+		abort();
+	}
+	componentInfos.resize(i + 1);
+	componentInfos[i] = ComponentInfo{name, size};
+	return i;
+}
+
+template<typename Component>
+ComponentId id() {
+	static ComponentId i = registerComponent(Component::NAME, sizeof(Component));
+	return i;
+}
+
+template<typename Component>
+Tag tag() {
+	return Tag::bit(id<Component>());
+}
+
+// Entities a pool reserves address space for up front, the reservation doubles whenever it is exceeded
+size_t POOL_RESERVED_ENTITIES = 1 << 20;
+
+// The bits of every registered component id, highest first
+std::string bits(Tag tag) {
+	std::string s(std::max<ComponentId>(COMPONENT_ID, 1), '0');
+	for(size_t i = 0; i < s.size(); i++) {
+		s[s.size() - 1 - i] = tag.test(i) ? '1' : '0';
+	}
+	return s;
+}
+
+// Component slots indexed by entity index in a reserved range of address space. The kernel commits pages
+// on first touch and trim() hands pages back once no component lives on them anymore.
+struct ComponentPool {
+	std::string name;
+	size_t componentSize;
+	size_t totalSize;
+	size_t pageSize;
+	char * data;
+	std::vector<unsigned int> pageUsers;
+	std::vector<bool> pageCommitted;
+	size_t committedPages;
+	size_t mappedSize; // Of the file mapped over the start of the reservation
+
+	ComponentPool(std::string const& _name, ComponentId _id, size_t _componentSize) :
+		name(_name),
+		componentSize(_componentSize),
+		pageSize(sysconf(_SC_PAGESIZE)),
+		committedPages(0),
+		mappedSize(0)
+	{
+		totalSize = (componentSize * POOL_RESERVED_ENTITIES + pageSize - 1) / pageSize * pageSize;
+		data = (char*)mmap(nullptr, totalSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (data == MAP_FAILED) {
+			perror("ComponentPool mmap");
+			abort();
+		}
+		pageUsers.resize(totalSize / pageSize, 0);
+		pageCommitted.resize(totalSize / pageSize, false);
+	}
+
+	template<typename Component>
+	explicit ComponentPool(Component const& dummy) : ComponentPool(Component::NAME, id<Component>(), sizeof(Component)) {}
+
+	// Maps length bytes of the file at offset copy on write over the start of the reservation, the slots are
+	// read from the page cache on first touch and writes stay private. The slots in use still have to be acquired.
+	ComponentPool(std::string const& _name, ComponentId _id, size_t _componentSize, int fd, size_t offset, size_t length) : ComponentPool(_name, _id, _componentSize) {
+		if (length > totalSize) {
+			grow(length);
+		}
+		if (length > 0 && mmap(data, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) {
+			perror("ComponentPool mmap file");
+			abort();
+		}
+		mappedSize = length;
+	}
+
+	~ComponentPool() {
+		munmap(data, totalSize);
+	}
+
+	void* operator[](size_t i) {
+		return data + i * componentSize;
+	}
+
+	// Marks slot i as in use, call before constructing a component in it
+	void acquire(size_t i) {
+		size_t end = (i + 1) * componentSize;
+		if (end > totalSize) {
+			grow(end);
+		}
+		for(size_t p = i * componentSize / pageSize; p <= (end - 1) / pageSize; p++) {
+			if (pageUsers[p]++ == 0 && !pageCommitted[p]) {
+				pageCommitted[p] = true;
+				committedPages++;
+			}
+		}
+	}
+
+	// Same as acquiring each slot, counted a page at a time
+	void acquireRange(size_t first, size_t n) {
+		if (n == 0) {
+			return;
+		}
+		size_t begin = first * componentSize;
+		size_t end = (first + n) * componentSize;
+		if (end > totalSize) {
+			grow(end);
+		}
+		for(size_t p = begin / pageSize; p <= (end - 1) / pageSize; p++) {
+			size_t pageBegin = std::max(begin, p * pageSize);
+			size_t pageEnd = std::min(end, (p + 1) * pageSize);
+			unsigned int users = (pageEnd - 1) / componentSize - pageBegin / componentSize + 1;
+			if (pageUsers[p] == 0 && !pageCommitted[p]) {
+				pageCommitted[p] = true;
+				committedPages++;
+			}
+			pageUsers[p] += users;
+		}
+	}
+
+	void release(size_t i) {
+		size_t end = (i + 1) * componentSize;
+		for(size_t p = i * componentSize / pageSize; p <= (end - 1) / pageSize; p++) {
+			pageUsers[p]--;
+		}
+	}
+
+	// Returns the memory of every page without components to the kernel, they read as zero if touched again
+	void trim() {
+		size_t p = 0;
+		while (p < pageUsers.size()) {
+			if (!pageCommitted[p] || pageUsers[p] > 0) {
+				p++;
+				continue;
+			}
+			size_t first = p;
+			while (p < pageUsers.size() && pageCommitted[p] && pageUsers[p] == 0) {
+				pageCommitted[p] = false;
+				committedPages--;
+				p++;
+			}
+			madvise(data + first * pageSize, (p - first) * pageSize, MADV_DONTNEED);
+		}
+	}
+
+	size_t committedSize() const {
+		return committedPages * pageSize;
+	}
+
+private:
+	void grow(size_t minSize) {
+		size_t newSize = totalSize;
+		while (newSize < minSize) {
+			newSize *= 2;
+		}
+		if (mappedSize > 0) {
+			growMapped(newSize);
+			return;
+		}
+		data = (char*)mremap(data, totalSize, newSize, MREMAP_MAYMOVE);
+		if (data == MAP_FAILED) {
+			perror("ComponentPool mremap");
+			abort();
+		}
+		totalSize = newSize;
+		pageUsers.resize(totalSize / pageSize, 0);
+		pageCommitted.resize(totalSize / pageSize, false);
+	}
+
+	// mremap can not move a file mapping together with the anonymous rest of the reservation, so the
+	// committed pages are copied into a fresh reservation instead
+	void growMapped(size_t newSize) {
+		char* newData = (char*)mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (newData == MAP_FAILED) {
+			perror("ComponentPool mmap");
+			abort();
+		}
+		for(size_t p = 0; p < pageUsers.size(); p++) {
+			if (pageCommitted[p]) {
+				memcpy(newData + p * pageSize, data + p * pageSize, pageSize);
+			}
+		}
+		munmap(data, totalSize);
+		data = newData;
+		totalSize = newSize;
+		mappedSize = 0;
+		pageUsers.resize(totalSize / pageSize, 0);
+		pageCommitted.resize(totalSize / pageSize, false);
+	}
+
+	// Disallow copying
+	ComponentPool(ComponentPool const& old);
+	ComponentPool& operator=(ComponentPool const& other);
+};
+
+std::ostream &operator<<(std::ostream &os, ComponentPool const& m) { return os << ANSI_FG_GREEN << "ComponentPool{" << m.name << " " << static_cast<float>(m.committedSize()) / 1000000 << "MB/" << static_cast<float>(m.totalSize) / 1000000 << "MB " << "}" << ANSI_RESET; }
+
+typedef size_t EntityIndex;
+typedef unsigned int EntityVersion;
+
+const EntityIndex INVALID_ENTITY_INDEX(-1);
+
+struct EntityId {
+	EntityIndex index;
+	EntityVersion version;
+
+	bool isValid() const {
+		return index != INVALID_ENTITY_INDEX;
+	}
+
+	bool operator==(EntityId const& other) const {
+		return index == other.index && version == other.version;
+	}
+
+	bool operator!=(EntityId const& other) const {
+		return !(*this == other);
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, EntityId const& m) {
+	os << ANSI_FG_GRAY << "EntityId{";
+	if (m.index == INVALID_ENTITY_INDEX) {
+		os << "INVALID";
+	} else {
+		os << m.index;
+	}
+	return os << " " << m.version << "}" << ANSI_RESET;
+}
+
+const EntityId INVALID_ENTITY_ID{INVALID_ENTITY_INDEX, 0};
+
+typedef std::vector<EntityIndex> EntityIndexList;
+
+const size_t NOT_MATCHED(-1);
+
+// Dense list of the indexes of the living entities matching a signature, kept up to date as signatures change
+struct Query {
+	Tag signature;
+	EntityIndexList indexes;
+	std::vector<size_t> slots; // Position in indexes, indexed by entity index
+	// The entities that started and stopped matching, only kept once someone takes them
+	bool keepsChanges;
+	EntityIndexList joined;
+	EntityIndexList left;
+
+	explicit Query(Tag _signature) : signature(_signature), keepsChanges(false) {}
+
+	bool contains(EntityIndex index) const {
+		return index < slots.size() && slots[index] != NOT_MATCHED;
+	}
+
+	void insert(EntityIndex index) {
+		if (slots.size() <= index) {
+			slots.resize(index + 1, NOT_MATCHED);
+		}
+		slots[index] = indexes.size();
+		indexes.push_back(index);
+		if (keepsChanges) {
+			joined.push_back(index);
+		}
+	}
+
+	// Inserts the n consecutive indexes starting at first, none of which may match yet
+	void insertRange(EntityIndex first, size_t n) {
+		if (slots.size() < first + n) {
+			slots.resize(first + n, NOT_MATCHED);
+		}
+		size_t slot = indexes.size();
+		indexes.resize(slot + n);
+		for(size_t i = 0; i < n; i++) {
+			indexes[slot + i] = first + i;
+			slots[first + i] = slot + i;
+		}
+		if (keepsChanges) {
+			joined.insert(joined.end(), indexes.begin() + slot, indexes.end());
+		}
+	}
+
+	void erase(EntityIndex index) {
+		size_t slot = slots[index];
+		EntityIndex last = indexes.back();
+		indexes[slot] = last;
+		slots[last] = slot;
+		indexes.pop_back();
+		slots[index] = NOT_MATCHED;
+		if (keepsChanges) {
+			left.push_back(index);
+		}
+	}
+
+	size_t size() const {
+		return indexes.size();
+	}
+
+	void clear() {
+		if (keepsChanges) {
+			left.insert(left.end(), indexes.begin(), indexes.end());
+		}
+		indexes.clear();
+		slots.clear();
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, Query const& m) { return os << ANSI_FG_CYAN_DARK << "Query{" << bits(m.signature) << " " << m.size() << "}" << ANSI_RESET; }
+
+// One bit per entity index, with a summary bit per word telling whether the word has any bit set, so finding
+// the next set bit skips 64 empty words at a time
+struct EntityBitset {
+	std::vector<uint64_t> words;
+	std::vector<uint64_t> summary;
+	size_t count;
+
+	EntityBitset() : count(0) {}
+
+	bool test(EntityIndex i) const {
+		return (i >> 6) < words.size() && (words[i >> 6] >> (i & 63) & 1) != 0;
+	}
+
+	void set(EntityIndex i) {
+		if ((i >> 6) >= words.size()) {
+			words.resize((i >> 6) + 1, 0);
+			summary.resize((words.size() + 63) >> 6, 0);
+		}
+		uint64_t& word = words[i >> 6];
+		if ((word >> (i & 63) & 1) == 0) {
+			word |= uint64_t(1) << (i & 63);
+			summary[i >> 12] |= uint64_t(1) << ((i >> 6) & 63);
+			count++;
+		}
+	}
+
+	void reset(EntityIndex i) {
+		if (!test(i)) {
+			return;
+		}
+		uint64_t& word = words[i >> 6];
+		word &= ~(uint64_t(1) << (i & 63));
+		if (word == 0) {
+			summary[i >> 12] &= ~(uint64_t(1) << ((i >> 6) & 63));
+		}
+		count--;
+	}
+
+	void setRange(EntityIndex first, size_t n) {
+		for(size_t i = 0; i < n; i++) {
+			set(first + i);
+		}
+	}
+
+	void clear() {
+		words.clear();
+		summary.clear();
+		count = 0;
+	}
+
+	// Keeps the bits set in both, sized to the shorter
+	void intersect(EntityBitset const& other) {
+		words.resize(std::min(words.size(), other.words.size()));
+		summary.assign((words.size() + 63) >> 6, 0);
+		count = 0;
+		for(size_t w = 0; w < words.size(); w++) {
+			words[w] &= other.words[w];
+			if (words[w] != 0) {
+				summary[w >> 6] |= uint64_t(1) << (w & 63);
+				count += __builtin_popcountll(words[w]);
+			}
+		}
+	}
+
+	// The first set index at or after i, INVALID_ENTITY_INDEX if there is none
+	EntityIndex next(EntityIndex i) const {
+		size_t w = i >> 6;
+		if (w >= words.size()) {
+			return INVALID_ENTITY_INDEX;
+		}
+		uint64_t bits = words[w] & (~uint64_t(0) << (i & 63));
+		if (bits != 0) {
+			return (w << 6) + __builtin_ctzll(bits);
+		}
+		w++;
+		for(size_t s = w >> 6; s < summary.size(); s++) {
+			uint64_t present = summary[s];
+			if (s == w >> 6) {
+				present &= ~uint64_t(0) << (w & 63);
+			}
+			if (present != 0) {
+				size_t found = (s << 6) + __builtin_ctzll(present);
+				return (found << 6) + __builtin_ctzll(words[found]);
+			}
+		}
+		return INVALID_ENTITY_INDEX;
+	}
+};
+
+struct Queries {
+	std::unordered_map<Tag, Query*> bySignature;
+	std::vector<Query*> list;
+	std::mutex mutex; // Guards registration, which can happen from systems running in parallel
+	// The signature of every entity packed apart from the entities, indexed by entity index and empty once removed,
+	// so scans for a signature stream through them with simd
+	std::vector<Tag> signatures;
+	// The living entities having each component, indexed by component id, so a signature's rarest component
+	// bounds the entities that can match it
+	std::vector<Query> members;
+
+	~Queries() {
+		for(Query* query : list) {
+			delete query;
+		}
+	}
+
+	size_t count(ComponentId id) const {
+		return id < members.size() ? members[id].size() : 0;
+	}
+
+	// The living entities having the component, empty for one no entity had yet
+	EntityIndexList const& membersOf(ComponentId id) const {
+		static const EntityIndexList none;
+		return id < members.size() ? members[id].indexes : none;
+	}
+
+	// The component of the signature fewest entities have, INVALID_COMPONENT_ID for the empty signature
+	ComponentId rarest(Tag signature) const {
+		ComponentId best = INVALID_COMPONENT_ID;
+		for(size_t c = signature.next(0); c < Tag::BITS; c = signature.next(c + 1)) {
+			if (best == INVALID_COMPONENT_ID || count(c) < count(best)) {
+				best = c;
+			}
+		}
+		return best;
+	}
+
+	// Forgets every entity, the registered queries stay registered
+	void clear() {
+		for(Query* query : list) {
+			query->clear();
+		}
+		for(Query& m : members) {
+			m.clear();
+		}
+		signatures.clear();
+	}
+
+	void insertRange(EntityIndex first, size_t n, Tag components) {
+		if (signatures.size() < first + n) {
+			signatures.resize(first + n);
+		}
+		std::fill_n(signatures.begin() + first, n, components);
+		for(size_t c = components.next(0); c < Tag::BITS; c = components.next(c + 1)) {
+			member(c).insertRange(first, n);
+		}
+		for(Query* query : list) {
+			if ((components & query->signature) == query->signature) {
+				query->insertRange(first, n);
+			}
+		}
+	}
+
+	// Called whenever an entity is created, removed or changes signature
+	void update(EntityIndex index, bool alive, Tag components) {
+		if (signatures.size() <= index) {
+			signatures.resize(index + 1);
+		}
+		Tag before = signatures[index];
+		Tag after = alive ? components : Tag(0);
+		signatures[index] = after;
+		Tag lost = before & ~after;
+		for(size_t c = lost.next(0); c < Tag::BITS; c = lost.next(c + 1)) {
+			members[c].erase(index);
+		}
+		Tag gained = after & ~before;
+		for(size_t c = gained.next(0); c < Tag::BITS; c = gained.next(c + 1)) {
+			member(c).insert(index);
+		}
+		for(Query* query : list) {
+			bool matches = alive && (components & query->signature) == query->signature;
+			if (matches != query->contains(index)) {
+				if (matches) {
+					query->insert(index);
+				} else {
+					query->erase(index);
+				}
+			}
+		}
+	}
+
+private:
+	Query& member(ComponentId id) {
+		while (members.size() <= id) {
+			members.emplace_back(Tag::bit(members.size()));
+		}
+		return members[id];
+	}
+};
+
+
+struct Entity {
+	EntityId id;
+	Tag components;
+	Queries* queries;
+
+	explicit Entity(EntityId _id, Queries* _queries = nullptr) : id(_id), components(0), queries(_queries) {}
+
+	template<typename Component>
+	Entity& addComponent() {
+		components = components | (tag<Component>());
+		changed();
+		return *this;
+	}
+
+	template<typename Component>
+	Entity& removeComponent() {
+		components = components & (~(tag<Component>()));
+		changed();
+		return *this;
+	}
+
+	void changed() {
+		if (queries != nullptr) {
+			queries->update(id.index, isValid(), components);
+		}
+	}
+
+	bool isValid() const {
+		return id.isValid();
+	}
+
+	bool matchesSignature(Tag signature) {
+		return (components & signature) == signature;
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, Entity const& m) {
+	os << ANSI_FG_MAGENTA << "Entity{";
+	if (m.id.index == INVALID_ENTITY_INDEX) {
+		os << "INVALID";
+	} else {
+		os << m.id.index;
+	}
+	return os<< " " << m.id.version << " " << bits(m.components) << "}" << ANSI_RESET;
+}
+
+// Log records carry entities as index, version and the lowest 64 bits of the signature
+Entity loggedEntity(uint64_t index, uint64_t version, uint64_t components) {
+	Entity e(EntityId{index, (EntityVersion)version});
+	e.components = components;
+	return e;
+}
+
+void formatIteratorTrace(std::ostream& os, LogRecord const& r) {
+	os << (char const*)r.args[0] << " " << loggedEntity(r.args[1], r.args[2], r.args[3]) << "\n";
+}
+
+void formatCreate(std::ostream& os, LogRecord const& r) {
+	os << newStr << loggedEntity(r.args[0], r.args[1], 0) << " there are now " << r.args[2] << "\n";
+}
+
+template<typename Component>
+void formatAssign(std::ostream& os, LogRecord const& r) {
+	if constexpr (std::is_trivially_copyable<Component>::value && sizeof(Component) <= LOG_PAYLOAD_SIZE) {
+		os << assignStr << r.value<Component>();
+	} else {
+		os << assignStr << Component::NAME;
+	}
+	os << " to " << loggedEntity(r.args[0], r.args[1], r.args[2]) << "\n";
+}
+
+template<typename Component>
+void logAssign([[maybe_unused]] Component const& component, [[maybe_unused]] Entity const& entity) {
+	if constexpr (std::is_trivially_copyable<Component>::value && sizeof(Component) <= LOG_PAYLOAD_SIZE) {
+		LOG_DEBUG(pushValue, formatAssign<Component>, component, entity.id.index, entity.id.version, entity.components.low());
+	} else {
+		LOG_DEBUG(push, formatAssign<Component>, entity.id.index, entity.id.version, entity.components.low());
+	}
+}
+
+enum class Storage { Pool, Archetype };
+
+// Copies the value into n consecutive slots, doubling the copied prefix every step
+void fillRepeated(char* dst, void const* value, size_t size, size_t n) {
+	if (n == 0) {
+		return;
+	}
+	memcpy(dst, value, size);
+	size_t done = 1;
+	while (done < n) {
+		size_t k = std::min(done, n - done);
+		memcpy(dst + done * size, dst, k * size);
+		done += k;
+	}
+}
+
+// Components count as changed or added when their tick is newer than the tick a reader last looked at
+typedef uint32_t Tick;
+
+const size_t CHUNK_SIZE = 1 << 14;
+const size_t COLUMN_ALIGNMENT = 16;
+
+// Entities sharing a signature, packed into fixed size chunks with one column per component
+struct Archetype {
+	Tag signature;
+	std::vector<ComponentId> componentIds;
+	std::vector<size_t> columnOffsets; // Indexed by component id
+	std::vector<size_t> columnSizes;   // Indexed by component id
+	size_t capacity;                   // Rows per chunk
+	size_t count;
+	std::vector<char*> chunks;
+	// Newest change and addition in each column of each chunk, indexed by chunk * columnSizes.size() + component id
+	std::vector<Tick> changedTicks;
+	std::vector<Tick> addedTicks;
+
+	Archetype(Tag _signature, std::vector<size_t> const& componentSizes) : signature(_signature), count(0) {
+		size_t rowSize = sizeof(EntityIndex);
+		for(ComponentId i = 0; i < componentSizes.size(); i++) {
+			if(signature.test(i)) {
+				componentIds.push_back(i);
+				rowSize += componentSizes[i];
+			}
+		}
+		capacity = CHUNK_SIZE / rowSize;
+		// Round down until the aligned columns fit in the chunk
+		while(true) {
+			size_t offset = capacity * sizeof(EntityIndex);
+			columnOffsets.assign(componentSizes.size(), 0);
+			columnSizes.assign(componentSizes.size(), 0);
+			for(ComponentId i : componentIds) {
+				offset = (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+				columnOffsets[i] = offset;
+				columnSizes[i] = componentSizes[i];
+				offset += capacity * componentSizes[i];
+			}
+			if(offset <= CHUNK_SIZE || capacity == 1) {
+				break;
+			}
+			capacity--;
+		}
+	}
+
+	~Archetype() {
+		for(char* chunk : chunks) {
+			delete[] chunk;
+		}
+	}
+
+	bool has(ComponentId id) const {
+		return id < columnSizes.size() && columnSizes[id] > 0;
+	}
+
+	size_t rows(size_t chunk) const {
+		return chunk + 1 < chunks.size() ? capacity : count - chunk * capacity;
+	}
+
+	EntityIndex* entities(size_t chunk) {
+		return (EntityIndex*)chunks[chunk];
+	}
+
+	void* column(ComponentId id, size_t chunk) {
+		return chunks[chunk] + columnOffsets[id];
+	}
+
+	void* at(ComponentId id, size_t row) {
+		return chunks[row / capacity] + columnOffsets[id] + (row % capacity) * columnSizes[id];
+	}
+
+	EntityIndex& entityAt(size_t row) {
+		return entities(row / capacity)[row % capacity];
+	}
+
+	Tick& changedTick(ComponentId id, size_t chunk) {
+		return changedTicks[chunk * columnSizes.size() + id];
+	}
+
+	Tick& addedTick(ComponentId id, size_t chunk) {
+		return addedTicks[chunk * columnSizes.size() + id];
+	}
+
+	// Every column of the chunk got a new row
+	void stamp(size_t chunk, Tick tick) {
+		for(ComponentId i : componentIds) {
+			changedTick(i, chunk) = tick;
+			addedTick(i, chunk) = tick;
+		}
+	}
+
+	size_t push(EntityIndex index, Tick tick) {
+		if(count == chunks.size() * capacity) {
+			addChunk();
+		}
+		entityAt(count) = index;
+		stamp(count / capacity, tick);
+		return count++;
+	}
+
+	// Appends rows for the n entities starting at first, returns the first row
+	size_t pushMany(EntityIndex first, size_t n, Tick tick) {
+		size_t row = count;
+		while (chunks.size() * capacity < count + n) {
+			addChunk();
+		}
+		for(size_t i = 0; i < n; i++) {
+			entityAt(count++) = first + i;
+		}
+		for(size_t chunk = row / capacity; n > 0 && chunk <= (count - 1) / capacity; chunk++) {
+			stamp(chunk, tick);
+		}
+		return row;
+	}
+
+	// Copies the value into the component's column for n rows starting at row
+	void fill(ComponentId id, size_t row, size_t n, void const* value) {
+		while (n > 0) {
+			size_t k = std::min(n, capacity - row % capacity);
+			fillRepeated((char*)at(id, row), value, columnSizes[id], k);
+			row += k;
+			n -= k;
+		}
+	}
+
+	// Fills the hole with the last row, returns the index of the entity that was moved into it
+	EntityIndex erase(size_t row) {
+		size_t last = count - 1;
+		EntityIndex moved = INVALID_ENTITY_INDEX;
+		if(row != last) {
+			for(ComponentId i : componentIds) {
+				memcpy(at(i, row), at(i, last), columnSizes[i]);
+			}
+			moved = entityAt(last);
+			entityAt(row) = moved;
+			// The moved row brings its ticks along, merged with those of the chunk it lands in
+			for(ComponentId i : componentIds) {
+				changedTick(i, row / capacity) = std::max(changedTick(i, row / capacity), changedTick(i, last / capacity));
+				addedTick(i, row / capacity) = std::max(addedTick(i, row / capacity), addedTick(i, last / capacity));
+			}
+		}
+		count--;
+		if(count <= (chunks.size() - 1) * capacity) {
+			delete[] chunks.back();
+			chunks.pop_back();
+			changedTicks.resize(chunks.size() * columnSizes.size());
+			addedTicks.resize(chunks.size() * columnSizes.size());
+		}
+		return moved;
+	}
+
+private:
+	void addChunk() {
+		chunks.push_back(new char[CHUNK_SIZE]);
+		changedTicks.resize(chunks.size() * columnSizes.size(), 0);
+		addedTicks.resize(chunks.size() * columnSizes.size(), 0);
+	}
+
+	// Disallow copying
+	Archetype(Archetype const& old);
+	Archetype& operator=(Archetype const& other);
+};
+
+std::ostream &operator<<(std::ostream &os, Archetype const& m) { return os << ANSI_FG_GREEN << "Archetype{" << bits(m.signature) << " " << m.count << " " << m.chunks.size() << "x" << m.capacity << "}" << ANSI_RESET; }
+
+struct ArchetypeRow {
+	Archetype* archetype;
+	size_t row;
+};
+
+struct ArchetypeChunk {
+	Archetype* archetype;
+	size_t chunk;
+	size_t count;
+
+	EntityIndex* entities() const {
+		return archetype->entities(chunk);
+	}
+
+	template<typename Component>
+	Component* column() const {
+		return (Component*)archetype->column(id<Component>(), chunk);
+	}
+
+	// Whether any of the components changed, or were added when added is set, after since
+	bool ticked(Tag components, Tick since, bool added) const {
+		for(ComponentId i : archetype->componentIds) {
+			if (components.test(i) && (added ? archetype->addedTick(i, chunk) : archetype->changedTick(i, chunk)) > since) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void markChanged(Tag components, Tick tick) const {
+		for(ComponentId i : archetype->componentIds) {
+			if (components.test(i)) {
+				archetype->changedTick(i, chunk) = tick;
+			}
+		}
+	}
+};
+
+struct Components;
+
+template<typename Component>
+void prepare(Components& components);
+
+// A signature together with the initial value of each of its components
+struct Prefab {
+	struct Default {
+		ComponentId id;
+		size_t size;
+		size_t offset; // Of the value in data
+		void (*prepare)(Components& components);
+	};
+
+	std::string name;
+	Tag signature;
+	std::vector<Default> defaults;
+	std::vector<char> data;
+
+	explicit Prefab(std::string const& _name) : name(_name), signature(0) {}
+
+	template<typename Component>
+	Prefab& with(Component const& init) {
+		size_t offset = (data.size() + alignof(Component) - 1) / alignof(Component) * alignof(Component);
+		data.resize(offset + sizeof(Component));
+		new (&data[offset]) Component(init);
+		defaults.erase(std::remove_if(defaults.begin(), defaults.end(), [](Default const& d) { return d.id == id<Component>(); }), defaults.end());
+		defaults.push_back(Default{id<Component>(), sizeof(Component), offset, prepare<Component>});
+		signature = signature | tag<Component>();
+		return *this;
+	}
+
+	void const* value(Default const& d) const {
+		return data.data() + d.offset;
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, Prefab const& m) { return os << ANSI_FG_GREEN << "Prefab{" << m.name << " " << bits(m.signature) << "}" << ANSI_RESET; }
+
+struct Components {
+	Storage storage;
+	std::vector<ComponentPool*> componentPools;
+	std::vector<size_t> componentSizes;
+	std::unordered_map<Tag, Archetype*> archetypes;
+	std::vector<ArchetypeRow> rows; // Indexed by entity index
+	// Pool storage keeps the ticks of every entity, indexed by component id and then entity index
+	std::vector<std::vector<Tick>> changedTicks;
+	std::vector<std::vector<Tick>> addedTicks;
+	std::atomic<Tick> currentTick;
+
+	explicit Components(Storage _storage = Storage::Pool) : storage(_storage), currentTick(1) {}
+
+	~Components() {
+		for(ComponentPool* pool : componentPools) {
+			delete pool;
+		}
+		for(auto& [signature, archetype] : archetypes) {
+			delete archetype;
+		}
+	}
+
+	template<typename Component>
+	Component* assign(Entity& entity, Component const& init) {
+		ProfileScope scope("assign", "structural");
+		profileVisit(1, sizeof(Component));
+		prepare<Component>();
+		Component* cp;
+		if (storage == Storage::Archetype) {
+			relocate(entity, entity.components | tag<Component>());
+			cp = new (at(entity, id<Component>())) Component(init);
+		} else {
+			ComponentPool& pool = *componentPools[id<Component>()];
+			if ((entity.components & tag<Component>()) == 0) {
+				pool.acquire(entity.id.index);
+				stamp(id<Component>(), entity.id.index, 1);
+			}
+			cp = new (pool[entity.id.index]) Component(init);
+		}
+		markChanged(entity, id<Component>());
+		entity.addComponent<Component>();
+		logAssign(*cp, entity);
+		return cp;
+	}
+
+	// Registers the component's size and creates its pool in pool storage
+	template<typename Component>
+	void prepare() {
+		prepare(id<Component>(), Component::NAME, sizeof(Component));
+	}
+
+	void prepare(ComponentId componentId, std::string const& name, size_t size) {
+		makeRoom(componentId);
+		componentSizes[componentId] = size;
+		if (storage == Storage::Pool && componentPools[componentId] == nullptr) {
+			ComponentPool* newPool = new ComponentPool(name, componentId, size);
+			componentPools[componentId] = newPool;
+			LOG_INFO(pushText, [](std::ostream& os, LogRecord const& r) {
+				os << newStr << ANSI_FG_GREEN << "ComponentPool{" << r.text() << " " << r.args[0] << "B " << static_cast<float>(r.args[1]) / 1000000 << "MB reserved}" << ANSI_RESET << "\n";
+			}, newPool->name, newPool->componentSize, newPool->totalSize);
+		}
+	}
+
+	// Gives the n fresh entities starting at first the components of the prefab, filling each column in bulk
+	void instantiate(Prefab const& prefab, EntityIndex first, size_t n) {
+		for(Prefab::Default const& d : prefab.defaults) {
+			d.prepare(*this);
+		}
+		if (n == 0 || prefab.signature == 0) {
+			return;
+		}
+		if (storage == Storage::Archetype) {
+			Archetype* a = archetype(prefab.signature);
+			size_t row = a->pushMany(first, n, tick());
+			if (rows.size() < first + n) {
+				rows.resize(first + n, ArchetypeRow{nullptr, 0});
+			}
+			for(size_t i = 0; i < n; i++) {
+				rows[first + i] = ArchetypeRow{a, row + i};
+			}
+			for(Prefab::Default const& d : prefab.defaults) {
+				a->fill(d.id, row, n, prefab.value(d));
+			}
+		} else {
+			for(Prefab::Default const& d : prefab.defaults) {
+				ComponentPool& pool = *componentPools[d.id];
+				pool.acquireRange(first, n);
+				fillRepeated((char*)pool[first], prefab.value(d), d.size, n);
+				stamp(d.id, first, n);
+			}
+		}
+	}
+
+	Tick tick() const {
+		return currentTick.load(std::memory_order_relaxed);
+	}
+
+	// Starts a new tick, changes made from now on are newer than every earlier one
+	Tick advance() {
+		return currentTick.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	// The component of the entity for writing, marks it changed at the current tick
+	template<typename Component>
+	Component* write(Entity const& entity) {
+		Component* cp = get<Component>(entity);
+		if (cp != nullptr) {
+			markChanged(entity, id<Component>());
+		}
+		return cp;
+	}
+
+	// Archetype storage tracks the ticks of whole chunks, so there it also reports the other entities of the chunk
+	template<typename Component>
+	bool changedSince(Entity const& entity, Tick since) {
+		return (entity.components & tag<Component>()) != 0 && ticks(entity, id<Component>(), false) > since;
+	}
+
+	template<typename Component>
+	bool addedSince(Entity const& entity, Tick since) {
+		return (entity.components & tag<Component>()) != 0 && ticks(entity, id<Component>(), true) > since;
+	}
+
+	void markChanged(Entity const& entity, ComponentId componentId, Tick tick) {
+		if (storage == Storage::Archetype) {
+			ArchetypeRow const& r = rows[entity.id.index];
+			r.archetype->changedTick(componentId, r.row / r.archetype->capacity) = tick;
+		} else {
+			changedTicks[componentId][entity.id.index] = tick;
+		}
+	}
+
+	void markChanged(Entity const& entity, ComponentId componentId) {
+		markChanged(entity, componentId, tick());
+	}
+
+	// Marks the component of n entities in pool storage starting at first as added and changed now
+	void stamp(ComponentId componentId, EntityIndex first, size_t n) {
+		if (changedTicks[componentId].size() < first + n) {
+			changedTicks[componentId].resize(first + n, 0);
+			addedTicks[componentId].resize(first + n, 0);
+		}
+		std::fill_n(changedTicks[componentId].begin() + first, n, tick());
+		std::fill_n(addedTicks[componentId].begin() + first, n, tick());
+	}
+
+	template<typename Component>
+	void unassign(Entity& entity) {
+		ProfileScope scope("unassign", "structural");
+		profileVisit(1, 0);
+		if ((entity.components & tag<Component>()) == tag<Component>()) {
+			if (storage == Storage::Archetype) {
+				relocate(entity, entity.components & ~tag<Component>());
+			} else {
+				componentPools[id<Component>()]->release(entity.id.index);
+			}
+		}
+		entity.removeComponent<Component>();
+	}
+
+	// Releases the storage of every component of the entity, call before removing it from Entities
+	void remove(Entity& entity) {
+		ProfileScope scope("remove components", "structural");
+		profileVisit(1, 0);
+		if (storage == Storage::Archetype) {
+			relocate(entity, 0);
+			return;
+		}
+		for(ComponentId i = 0; i < componentPools.size(); i++) {
+			if (componentPools[i] != nullptr && entity.components.test(i)) {
+				componentPools[i]->release(entity.id.index);
+			}
+		}
+	}
+
+	// Moves the components of the entity to the free index to, where they count as added and changed now
+	void move(Entity const& entity, EntityIndex to) {
+		EntityIndex from = entity.id.index;
+		if (storage == Storage::Archetype) {
+			if (rows.size() <= to) {
+				rows.resize(to + 1, ArchetypeRow{nullptr, 0});
+			}
+			ArchetypeRow r = rows[from];
+			if (r.archetype != nullptr) {
+				r.archetype->entityAt(r.row) = to;
+				r.archetype->stamp(r.row / r.archetype->capacity, tick());
+			}
+			rows[to] = r;
+			rows[from] = ArchetypeRow{nullptr, 0};
+			return;
+		}
+		for(ComponentId i = 0; i < componentPools.size(); i++) {
+			if (componentPools[i] != nullptr && entity.components.test(i)) {
+				ComponentPool& pool = *componentPools[i];
+				pool.acquire(to);
+				memcpy(pool[to], pool[from], componentSizes[i]);
+				pool.release(from);
+				stamp(i, to, 1);
+			}
+		}
+	}
+
+	// Hands the pages emptied by removals back to the kernel
+	void trim() {
+		for(ComponentPool* pool : componentPools) {
+			if (pool != nullptr) {
+				pool->trim();
+			}
+		}
+	}
+
+	// Base of the pool indexed by entity index, nullptr if the component was never assigned
+	template<typename Component>
+	Component* pool() {
+		if (componentPools.size() <= id<Component>() || componentPools[id<Component>()] == nullptr) {
+			return nullptr;
+		}
+		return (Component*)componentPools[id<Component>()]->data;
+	}
+
+	template<typename Component>
+	Component* get(Entity const& entity) {
+		if((entity.components & tag<Component>()) != tag<Component>()) {
+			return nullptr;
+		}
+		if (storage == Storage::Archetype) {
+			return (Component*)at(entity, id<Component>());
+		}
+		return (Component*)(*componentPools[id<Component>()])[entity.id.index];
+	}
+
+	// Installs a pool created elsewhere, e.g. mapped from a snapshot, in place of an unused one
+	void adopt(ComponentId componentId, ComponentPool* pool) {
+		makeRoom(componentId);
+		componentSizes[componentId] = pool->componentSize;
+		delete componentPools[componentId];
+		componentPools[componentId] = pool;
+	}
+
+	// The bytes of a component the entity has, whatever the storage
+	void* raw(Entity const& entity, ComponentId componentId) {
+		if (storage == Storage::Archetype) {
+			return at(entity, componentId);
+		}
+		return (*componentPools[componentId])[entity.id.index];
+	}
+
+	// Stores every component of the entity's signature, copied from values indexed by component id
+	void restore(Entity& entity, std::vector<char const*> const& values) {
+		if (storage == Storage::Archetype) {
+			relocate(entity, entity.components);
+		}
+		for(ComponentId i = 0; i < componentSizes.size(); i++) {
+			if (!entity.components.test(i)) {
+				continue;
+			}
+			if (storage == Storage::Pool) {
+				componentPools[i]->acquire(entity.id.index);
+				stamp(i, entity.id.index, 1);
+			}
+			memcpy(raw(entity, i), values[i], componentSizes[i]);
+		}
+	}
+
+	// Every chunk of every archetype matching the signature, empty in pool storage
+	std::vector<ArchetypeChunk> chunks(Tag signature) {
+		std::vector<ArchetypeChunk> result;
+		for(auto& [archetypeSignature, archetype] : archetypes) {
+			if((archetypeSignature & signature) != signature) {
+				continue;
+			}
+			for(size_t i = 0; i < archetype->chunks.size(); i++) {
+				result.push_back(ArchetypeChunk{archetype, i, archetype->rows(i)});
+			}
+		}
+		return result;
+	}
+
+private:
+	void makeRoom(ComponentId componentId) {
+		if (componentSizes.size() <= componentId) {
+			componentSizes.resize(componentId + 1, 0);
+			componentPools.resize(componentId + 1, nullptr);
+			changedTicks.resize(componentId + 1);
+			addedTicks.resize(componentId + 1);
+		}
+	}
+
+	void* at(Entity const& entity, ComponentId id) {
+		ArchetypeRow const& r = rows[entity.id.index];
+		return r.archetype->at(id, r.row);
+	}
+
+	Tick ticks(Entity const& entity, ComponentId componentId, bool added) {
+		if (storage == Storage::Archetype) {
+			ArchetypeRow const& r = rows[entity.id.index];
+			size_t chunk = r.row / r.archetype->capacity;
+			return added ? r.archetype->addedTick(componentId, chunk) : r.archetype->changedTick(componentId, chunk);
+		}
+		return added ? addedTicks[componentId][entity.id.index] : changedTicks[componentId][entity.id.index];
+	}
+
+	Archetype* archetype(Tag signature) {
+		auto it = archetypes.find(signature);
+		if (it != archetypes.end()) {
+			return it->second;
+		}
+		Archetype* newArchetype = new Archetype(signature, componentSizes);
+		archetypes[signature] = newArchetype;
+		LOG_INFO(push, [](std::ostream& os, LogRecord const& r) {
+			os << newStr << ANSI_FG_GREEN << "Archetype{" << bits(r.args[0]) << " " << r.args[1] << " per chunk}" << ANSI_RESET << "\n";
+		}, signature.low(), newArchetype->capacity);
+		return newArchetype;
+	}
+
+	// Moves the entity and the components it keeps into the archetype of the new signature
+	void relocate(Entity& entity, Tag signature) {
+		EntityIndex index = entity.id.index;
+		if (rows.size() <= index) {
+			rows.resize(index + 1, ArchetypeRow{nullptr, 0});
+		}
+		ArchetypeRow from = rows[index];
+		if (from.archetype != nullptr && from.archetype->signature == signature) {
+			return;
+		}
+		ArchetypeRow to{nullptr, 0};
+		if (signature != 0) {
+			to.archetype = archetype(signature);
+			to.row = to.archetype->push(index, tick());
+		}
+		if (from.archetype != nullptr) {
+			for(ComponentId i : from.archetype->componentIds) {
+				if (to.archetype != nullptr && to.archetype->has(i)) {
+					memcpy(to.archetype->at(i, to.row), from.archetype->at(i, from.row), componentSizes[i]);
+				}
+			}
+			EntityIndex moved = from.archetype->erase(from.row);
+			if (moved != INVALID_ENTITY_INDEX) {
+				rows[moved].row = from.row;
+			}
+		}
+		rows[index] = to;
+	}
+
+	Components(Components const& old);
+	Components& operator=(Components const& other);
+};
+
+template<typename Component>
+void prepare(Components& components) {
+	components.prepare<Component>();
+}
+
+typedef std::vector<Entity> EntityList;
+
+// An entity given a new index by compaction
+struct EntityMove {
+	EntityId from;
+	EntityId to;
+};
+
+// Entities created together occupying consecutive fresh indexes
+struct EntityRange {
+	EntityIndex first;
+	size_t count;
+
+	struct Iterator {
+		EntityIndex index;
+		EntityId operator*() const {
+			return EntityId{index, 0};
+		}
+		bool operator!=(Iterator const& other) const {
+			return index != other.index;
+		}
+		Iterator& operator++() {
+			index++;
+			return *this;
+		}
+	};
+	Iterator begin() const { return Iterator{first}; }
+	Iterator end() const { return Iterator{first + count}; }
+};
+// Iterates the entities having all of the components, yielding references to the entity and each component.
+// Component columns are resolved once per view in pool storage and once per chunk in archetype storage.
+template<typename... Cs>
+struct TypedView {
+	typedef std::tuple<Entity&, Cs&...> Row;
+
+	// Chunk rows are packed columns, Query rows hold the entity index of each match
+	enum class SpanKind { Chunk, Query };
+
+	// Rows sharing the same column bases
+	struct Span {
+		SpanKind kind;
+		EntityIndex const* entities;
+		size_t count;
+		std::tuple<Cs*...> columns;
+		ArchetypeChunk chunk; // Of Chunk spans
+	};
+
+	EntityList& entityList;
+	Components& components;
+	Tag signature;
+	std::vector<Span> spans;
+	// In pool storage a row is only visited if, for every filter, one of its ticks is newer than since
+	struct TickFilter {
+		std::vector<Tick const*> ticks;
+		Tick since;
+	};
+	std::vector<TickFilter> filters;
+
+	// The query of the signature is only used, and only required, in pool storage
+	TypedView(EntityList& _entityList, Components& _components, Query const* query) : entityList(_entityList), components(_components), signature((tag<Cs>() | ...)) {
+		if (components.storage == Storage::Archetype) {
+			for(ArchetypeChunk const& chunk : components.chunks(signature)) {
+				spans.push_back(Span{SpanKind::Chunk, chunk.entities(), chunk.count, std::tuple<Cs*...>(chunk.template column<Cs>()...), chunk});
+			}
+		} else if (((components.template pool<Cs>() != nullptr) && ...)) {
+			spans.push_back(Span{SpanKind::Query, query->indexes.data(), query->indexes.size(), std::tuple<Cs*...>(components.template pool<Cs>()...), ArchetypeChunk{nullptr, 0, 0}});
+		}
+		if (profiler().isEnabled()) {
+			size_t rows = 0;
+			for(Span const& span : spans) {
+				rows += span.count;
+			}
+			profileVisit(rows, rows * (sizeof(Cs) + ...));
+		}
+	}
+
+	// Only visits rows where any of the components changed after since, in archetype storage whole chunks.
+	// Filters combine, and as the view refers to itself when iterated it has to be kept in a variable before
+	// a range based for.
+	TypedView& changedSince(Tick since, Tag filter = ~Tag(0)) {
+		return tickedSince(since, filter & signature, false);
+	}
+
+	TypedView& addedSince(Tick since, Tag filter = ~Tag(0)) {
+		return tickedSince(since, filter & signature, true);
+	}
+
+	// Marks the components of every row the view visits as changed at tick, call after any filters
+	TypedView& writes(Tag components, Tick tick) {
+		components &= signature;
+		if (components == 0) {
+			return *this;
+		}
+		for(Span& span : spans) {
+			if (span.kind == SpanKind::Chunk) {
+				span.chunk.markChanged(components, tick);
+				continue;
+			}
+			for(ComponentId i = 0; i < this->components.changedTicks.size(); i++) {
+				if (!components.test(i)) {
+					continue;
+				}
+				Tick* ticks = this->components.changedTicks[i].data();
+				for(size_t row = 0; row < span.count; row++) {
+					if (matches(span, row)) {
+						ticks[span.entities[row]] = tick;
+					}
+				}
+			}
+		}
+		return *this;
+	}
+
+	// Index into the columns of the span
+	size_t slot(Span const& span, size_t row) const {
+		return span.kind == SpanKind::Query ? span.entities[row] : row;
+	}
+
+	bool matches(Span const& span, size_t row) const {
+		return span.kind == SpanKind::Chunk || filters.empty() || ticked(span.entities[row]);
+	}
+
+	bool ticked(EntityIndex index) const {
+		for(TickFilter const& filter : filters) {
+			if (std::none_of(filter.ticks.begin(), filter.ticks.end(), [&](Tick const* ticks) { return ticks[index] > filter.since; })) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template<typename F>
+	void each(F&& fn) {
+		for(Span& span : spans) {
+			eachIn(span, 0, span.count, fn);
+		}
+	}
+
+	// Like each() but spread over the pool's threads, rows are handed out in disjoint ranges of grainSize
+	template<typename F>
+	void parallel_each(F const& fn, size_t grainSize = 1024, ThreadPool& pool = ThreadPool::global()) {
+		for(Span& span : spans) {
+			parallelFor(pool, 0, span.count, grainSize, [this, &span, &fn](size_t begin, size_t end) {
+				eachIn(span, begin, end, fn);
+			});
+		}
+	}
+
+	// Calls fn(count, Cs*...) for every run of consecutive matching rows, so kernels can work on packed columns
+	template<typename F>
+	void runs(F const& fn) {
+		for(Span& span : spans) {
+			runsIn(span, 0, span.count, fn);
+		}
+	}
+
+	template<typename F>
+	void parallel_runs(F const& fn, size_t grainSize = 1024, ThreadPool& pool = ThreadPool::global()) {
+		for(Span& span : spans) {
+			parallelFor(pool, 0, span.count, grainSize, [this, &span, &fn](size_t begin, size_t end) {
+				runsIn(span, begin, end, fn);
+			});
+		}
+	}
+
+	template<typename F>
+	void eachIn(Span& span, size_t begin, size_t end, F& fn) {
+		switch (span.kind) {
+		case SpanKind::Chunk:
+			for(size_t i = begin; i < end; i++) {
+				fn(entityList[span.entities[i]], std::get<Cs*>(span.columns)[i]...);
+			}
+			break;
+		case SpanKind::Query:
+			for(size_t i = begin; i < end; i++) {
+				EntityIndex index = span.entities[i];
+				if (filters.empty() || ticked(index)) {
+					fn(entityList[index], std::get<Cs*>(span.columns)[index]...);
+				}
+			}
+			break;
+		}
+	}
+
+	template<typename F>
+	void runsIn(Span& span, size_t begin, size_t end, F const& fn) {
+		if (span.kind == SpanKind::Chunk) {
+			fn(end - begin, (std::get<Cs*>(span.columns) + begin)...);
+			return;
+		}
+		size_t i = begin;
+		while (i < end) {
+			while (i < end && !matches(span, i)) {
+				i++;
+			}
+			if (i == end) {
+				break;
+			}
+			size_t first = i++;
+			while (i < end && matches(span, i) && slot(span, i) == slot(span, i - 1) + 1) {
+				i++;
+			}
+			fn(i - first, (std::get<Cs*>(span.columns) + slot(span, first))...);
+		}
+	}
+
+	struct Iterator {
+		TypedView& view;
+		size_t span;
+		size_t row;
+		Iterator(TypedView& _view, size_t _span, size_t _row) : view(_view), span(_span), row(_row) {}
+
+		Row operator*() const {
+			Span& s = view.spans[span];
+			size_t slot = view.slot(s, row);
+			return Row(view.entityList[s.entities[row]], std::get<Cs*>(s.columns)[slot]...);
+		}
+		bool operator==(Iterator const& other) const {
+			return span == other.span && row == other.row;
+		}
+		bool operator!=(Iterator const& other) const {
+			return span != other.span || row != other.row;
+		}
+		// Moves to the first matching row at or after the current one
+		Iterator& seek() {
+			while (span < view.spans.size()) {
+				if (row >= view.spans[span].count) {
+					span++;
+					row = 0;
+				} else if (view.matches(view.spans[span], row)) {
+					break;
+				} else {
+					row++;
+				}
+			}
+			return *this;
+		}
+		Iterator& operator++() {
+			row++;
+			return seek();
+		}
+	};
+	Iterator begin() { return Iterator(*this, 0, 0).seek(); }
+	Iterator end() { return Iterator(*this, spans.size(), 0); }
+
+private:
+	TypedView& tickedSince(Tick since, Tag filter, bool added) {
+		if (components.storage == Storage::Archetype) {
+			spans.erase(std::remove_if(spans.begin(), spans.end(), [&](Span const& span) { return !span.chunk.ticked(filter, since, added); }), spans.end());
+			return *this;
+		}
+		TickFilter tickFilter{{}, since};
+		for(ComponentId i = 0; i < components.changedTicks.size(); i++) {
+			if (filter.test(i)) {
+				tickFilter.ticks.push_back(added ? components.addedTicks[i].data() : components.changedTicks[i].data());
+			}
+		}
+		filters.push_back(tickFilter);
+		return *this;
+	}
+};
+
+// A component a planned query visits whether or not the entity has it, handed to the callback as a pointer that
+// is null where the entity lacks it
+template<typename Component>
+struct Optional {};
+
+// How each type a planned query is given for turns into a term and an argument of its callback, and
+// how it is looked up, from the pool base resolved once per query in pool storage, otherwise from the entity's row
+template<typename C>
+struct QueryTerm {
+	typedef C Component;
+	typedef C& Arg;
+	static Tag required() { return tag<C>(); }
+	static Tag optional() { return 0; }
+	static C& fetch(Components& components, Entity const& entity, C* pool) {
+		return pool != nullptr ? pool[entity.id.index] : *components.get<C>(entity);
+	}
+};
+
+template<typename C>
+struct QueryTerm<Optional<C>> {
+	typedef C Component;
+	typedef C* Arg;
+	static Tag required() { return 0; }
+	static Tag optional() { return tag<C>(); }
+	static C* fetch(Components& components, Entity const& entity, C* pool) {
+		if (!entity.components.test(id<C>())) {
+			return nullptr;
+		}
+		return pool != nullptr ? &pool[entity.id.index] : components.get<C>(entity);
+	}
+};
+
+// What a planned query visits: the members of its rarest required component, or every living entity when it
+// requires none, each candidate then checked against the rest of the terms
+struct QueryPlan {
+	Tag required;
+	Tag excluded;
+	Tag optional;
+	ComponentId driver; // INVALID_COMPONENT_ID when driven by the living entities
+	size_t candidates;
+};
+
+std::ostream &operator<<(std::ostream &os, QueryPlan const& m) {
+	os << ANSI_FG_CYAN_DARK << "QueryPlan{with " << bits(m.required) << " without " << bits(m.excluded) << " optional " << bits(m.optional) << " driven by ";
+	if (m.driver == INVALID_COMPONENT_ID) {
+		os << "living";
+	} else {
+		std::lock_guard<std::mutex> lock(componentInfosMutex);
+		os << componentInfos[m.driver].name;
+	}
+	return os << " over " << m.candidates << "}" << ANSI_RESET;
+}
+
+// Visits the entities having every required component and no excluded one, costing time proportional to the
+// fewest entities having any one required component rather than to all of them. Works in either storage.
+// Signatures must not change while visiting, make structural changes through a CommandBuffer.
+template<typename... Ts>
+struct PlannedQuery {
+	EntityList& entityList;
+	Components& components;
+	Queries const& queries;
+	EntityBitset const& alive;
+	QueryPlan plan;
+
+	PlannedQuery(EntityList& _entityList, Components& _components, Queries const& _queries, EntityBitset const& _alive) :
+		entityList(_entityList),
+		components(_components),
+		queries(_queries),
+		alive(_alive),
+		plan{(QueryTerm<Ts>::required() | ... | Tag(0)), 0, (QueryTerm<Ts>::optional() | ... | Tag(0)), INVALID_COMPONENT_ID, 0}
+	{
+		plan.driver = queries.rarest(plan.required);
+		plan.candidates = plan.driver == INVALID_COMPONENT_ID ? alive.count : queries.count(plan.driver);
+	}
+
+	template<typename... Cs>
+	PlannedQuery& without() {
+		plan.excluded |= (tag<Cs>() | ...);
+		return *this;
+	}
+
+	bool matches(EntityIndex index) const {
+		Tag signature = queries.signatures[index];
+		return (signature & plan.required) == plan.required && (signature & plan.excluded) == 0;
+	}
+
+	// Calls fn(Entity&, Args...) for every match, a reference for each required component and a pointer for each optional one
+	template<typename F>
+	void each(F&& fn) {
+		bool pooled = components.storage == Storage::Pool;
+		std::tuple<typename QueryTerm<Ts>::Component*...> pools(pooled ? components.template pool<typename QueryTerm<Ts>::Component>() : nullptr...);
+		visit([&](EntityIndex index) {
+			Entity& e = entityList[index];
+			fn(e, QueryTerm<Ts>::fetch(components, e, std::get<typename QueryTerm<Ts>::Component*>(pools))...);
+		});
+	}
+
+	size_t count() {
+		size_t n = 0;
+		visit([&](EntityIndex) {
+			n++;
+		});
+		return n;
+	}
+
+private:
+	template<typename F>
+	void visit(F&& fn) {
+		profileVisit(plan.candidates, plan.candidates * sizeof(Tag));
+		if (plan.driver != INVALID_COMPONENT_ID) {
+			for(EntityIndex index : queries.membersOf(plan.driver)) {
+				if (matches(index)) {
+					fn(index);
+				}
+			}
+			return;
+		}
+		for(EntityIndex index = alive.next(0); index != INVALID_ENTITY_INDEX; index = alive.next(index + 1)) {
+			if (index >= queries.signatures.size() || matches(index)) {
+				fn(index);
+			}
+		}
+	}
+};
+
+// Seedable generator of a world (splitmix64), its whole state is one word that recordings keep with every frame
+struct Random {
+	uint64_t state;
+
+	explicit Random(uint64_t seed = 0) : state(seed) {}
+
+	void seed(uint64_t seed) {
+		state = seed;
+	}
+
+	uint64_t next() {
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// Uniform in [0, n)
+	uint64_t below(uint64_t n) {
+		return next() % n;
+	}
+};
+
+// Entities reserve() hands out to one thread, only flush() and the reservation resets lock it besides its owner
+struct ReserveCache {
+	std::mutex mutex;
+	std::vector<EntityId> available; // Free indexes with the version they get when reserved
+	std::vector<EntityId> reserved; // Handed out since the last flush
+};
+
+// Free indexes a cache claims from the shared pool at once
+const size_t RESERVE_BATCH = 64;
+// Free indexes offered to reserving threads between flushes
+const size_t RESERVE_POOL = 4096;
+// Scans visit the members of the signature's rarest component instead of every living entity when they are this
+// many times fewer, members are visited out of order and cost more each than streaming the packed signatures
+const size_t MEMBER_DRIVE_RATIO = 16;
+
+struct Entities {
+private:
+	EntityList entityList;
+	EntityIndexList freeEntityIndexes;
+	EntityBitset aliveEntities;
+	Queries queries;
+	// Reservation from any thread, the pool is claimed from the back down through its cursor without locking
+	std::vector<EntityId> reusable;
+	std::atomic<ptrdiff_t> reusableCursor;
+	std::atomic<EntityIndex> nextFresh;
+	std::mutex cachesMutex;
+	std::vector<std::unique_ptr<ReserveCache>> caches;
+	uint64_t serial; // Tells the thread's caches of different instances apart
+	inline static std::atomic<uint64_t> serials = 0;
+public:
+	Random random;
+
+	// The free indexes, including those offered to reserving threads and not claimed yet, the next one reused last
+	EntityIndexList freeList() const {
+		EntityIndexList free(freeEntityIndexes);
+		for(ptrdiff_t i = 0; i < std::min<ptrdiff_t>(reusableCursor, reusable.size()); i++) {
+			free.push_back(reusable[i].index);
+		}
+		return free;
+	}
+
+	// The indexes of the living entities
+	EntityBitset const& alive() const {
+		return aliveEntities;
+	}
+
+	// The signature of every entity by index, 0 for the removed ones
+	std::vector<Tag> const& signatures() const {
+		return queries.signatures;
+	}
+
+	EntityList const& list() const {
+		return entityList;
+	}
+
+	static Entity INVALID_ENTITY;
+
+	size_t size() {
+		return entityList.size();
+	}
+
+	// Draws from the world's generator, so call it where the other structural changes are made
+	Entity& getRandom() {
+		return entityList[random.below(entityList.size())];
+	}
+
+	Entity const& operator[](EntityId id) {
+		if (!id.isValid() || entityList[id.index].id.version != id.version) {
+			return INVALID_ENTITY;
+		}
+		return entityList[id.index];
+	}
+
+	// The living entity with the id, nullptr if it was removed
+	Entity* find(EntityId id) {
+		if (!id.isValid() || id.index >= entityList.size() || !entityList[id.index].isValid() || entityList[id.index].id.version != id.version) {
+			return nullptr;
+		}
+		return &entityList[id.index];
+	}
+
+	Entities() : reusableCursor(0), nextFresh(0), serial(++serials) {}
+
+	// Reuses a free index if there is one, the ones flush() offered to reserving threads included
+	Entity& create() {
+		ProfileScope scope("create", "structural");
+		profileVisit(1, 0);
+		EntityId reused = INVALID_ENTITY_ID;
+		if (freeEntityIndexes.size() > 0) {
+			EntityIndex index = freeEntityIndexes.back();
+			freeEntityIndexes.pop_back();
+			reused = EntityId{index, entityList[index].id.version + 1};
+		} else if (reusableCursor.load(std::memory_order_relaxed) > 0) {
+			// Claimed through the cursor like reserve() does, a reserving thread may have taken the last one meanwhile
+			ptrdiff_t i = reusableCursor.fetch_sub(1) - 1;
+			if (i >= 0) {
+				reused = reusable[i];
+			}
+		}
+		if (reused.isValid()) {
+			Entity& e = entityList[reused.index];
+			e.id = reused;
+			aliveEntities.set(reused.index);
+			e.changed();
+			LOG_DEBUG(push, formatCreate, e.id.index, e.id.version, entityList.size());
+			return e;
+		} else {
+			EntityIndex index = nextFresh.fetch_add(1);
+			// Fresh indexes below it may be reserved and not flushed yet
+			entityList.resize(index + 1, Entity(INVALID_ENTITY_ID, &queries));
+			Entity& e = entityList[index];
+			e.id = EntityId{index, 0};
+			aliveEntities.set(index);
+			e.changed();
+			LOG_DEBUG(push, formatCreate, e.id.index, e.id.version, entityList.size());
+			return e;
+		}
+	}
+
+	// Replaces every entity and the free list, the registered queries are rebuilt and unflushed reservations dropped
+	void restore(EntityList list, EntityIndexList freeList) {
+		{
+			std::lock_guard<std::mutex> lock(cachesMutex);
+			std::vector<std::unique_lock<std::mutex>> locks = lockCaches();
+			for(std::unique_ptr<ReserveCache>& cache : caches) {
+				cache->available.clear();
+				cache->reserved.clear();
+			}
+			reusable.clear();
+			reusableCursor = 0;
+			nextFresh = list.size();
+		}
+		entityList = std::move(list);
+		freeEntityIndexes = std::move(freeList);
+		aliveEntities.clear();
+		queries.clear();
+		for(EntityIndex i = 0; i < entityList.size(); i++) {
+			entityList[i].queries = &queries;
+			if (entityList[i].isValid()) {
+				aliveEntities.set(i);
+				queries.update(i, true, entityList[i].components);
+			}
+		}
+	}
+
+	// Creates n entities from the prefab at fresh indexes, reserving the list and the component storage once
+	EntityRange createMany(Components& components, Prefab const& prefab, size_t n) {
+		ProfileScope scope("createMany", "structural");
+		profileVisit(n, n * prefab.data.size());
+		EntityIndex first = nextFresh.fetch_add(n);
+		entityList.resize(first + n, Entity(INVALID_ENTITY_ID, &queries));
+		for(size_t i = 0; i < n; i++) {
+			entityList[first + i].id = EntityId{first + i, 0};
+			entityList[first + i].components = prefab.signature;
+		}
+		aliveEntities.setRange(first, n);
+		queries.insertRange(first, n, prefab.signature);
+		components.instantiate(prefab, first, n);
+		LOG_DEBUG(pushText, [](std::ostream& os, LogRecord const& r) {
+			os << newStr << r.args[0] << " x " << ANSI_FG_GREEN << "Prefab{" << r.text() << " " << bits(r.args[1]) << "}" << ANSI_RESET << " there are now " << r.args[2] << "\n";
+		}, prefab.name, n, prefab.signature.low(), entityList.size());
+		return EntityRange{first, n};
+	}
+
+	void remove(EntityId id) {
+		ProfileScope scope("remove", "structural");
+		if (!id.isValid() || entityList[id.index].id.version != id.version) {
+			return;
+		}
+		profileVisit(1, 0);
+		Entity& e = entityList[id.index];
+		e.id = EntityId{INVALID_ENTITY_INDEX, e.id.version};
+		e.components = 0;
+		aliveEntities.reset(id.index);
+		queries.update(id.index, false, 0);
+		freeEntityIndexes.push_back(id.index);
+	}
+
+	// Reserves an id from any thread, the entity becomes alive without components at the next flush(). Each
+	// thread takes free indexes from a cache of its own, refilled RESERVE_BATCH at a time from the pool flush()
+	// tops up, and fresh indexes from an atomic counter once the pool runs dry.
+	EntityId reserve() {
+		ReserveCache& cache = localCache();
+		std::lock_guard<std::mutex> lock(cache.mutex);
+		if (cache.available.empty()) {
+			ptrdiff_t end = reusableCursor.fetch_sub(RESERVE_BATCH);
+			for(ptrdiff_t i = std::max<ptrdiff_t>(end - RESERVE_BATCH, 0); i < end; i++) {
+				cache.available.push_back(reusable[i]);
+			}
+		}
+		EntityId id;
+		if (cache.available.empty()) {
+			id = EntityId{nextFresh.fetch_add(1), 0};
+		} else {
+			id = cache.available.back();
+			cache.available.pop_back();
+		}
+		cache.reserved.push_back(id);
+		return id;
+	}
+
+	// Makes the entities reserved since the last flush alive and offers free indexes to reserving threads again.
+	// Call it at a sync point like the other structural changes, reserve() may keep running meanwhile.
+	void flush() {
+		std::lock_guard<std::mutex> lock(cachesMutex);
+		std::vector<std::unique_lock<std::mutex>> locks = lockCaches();
+		flushLocked();
+		reusable.resize(std::max<ptrdiff_t>(reusableCursor, 0));
+		while (reusable.size() < RESERVE_POOL && !freeEntityIndexes.empty()) {
+			EntityIndex index = freeEntityIndexes.back();
+			freeEntityIndexes.pop_back();
+			reusable.push_back(EntityId{index, entityList[index].id.version + 1});
+		}
+		reusableCursor = reusable.size();
+	}
+
+	// Moves the living entities with the highest indexes into the holes left by removed ones until the living
+	// entities are packed at the start of the list. A moved entity gets a new id, stale ids of either index no
+	// longer resolve, so holders of ids have to map them through the returned moves. Call components.trim()
+	// afterwards to hand back the pages the moves emptied. Reservations are flushed first and the free indexes
+	// cached for reserving taken back in the same hold of the caches, so no id handed out can land on a hole,
+	// reserving threads draw fresh indexes until the next flush.
+	std::vector<EntityMove> compact(Components& components) {
+		ProfileScope scope("compact", "structural");
+		{
+			std::lock_guard<std::mutex> lock(cachesMutex);
+			std::vector<std::unique_lock<std::mutex>> locks = lockCaches();
+			flushLocked();
+			for(std::unique_ptr<ReserveCache>& cache : caches) {
+				cache->available.clear();
+			}
+			reusable.clear();
+			reusableCursor = 0;
+		}
+		std::vector<EntityMove> moves;
+		EntityIndex source = entityList.size();
+		for(EntityIndex hole = 0; hole < aliveEntities.count; hole++) {
+			if (aliveEntities.test(hole)) {
+				continue;
+			}
+			do {
+				source--;
+			} while (!aliveEntities.test(source));
+			Entity& from = entityList[source];
+			Entity& to = entityList[hole];
+			components.move(from, hole);
+			moves.push_back(EntityMove{from.id, EntityId{hole, to.id.version + 1}});
+			to.id = moves.back().to;
+			to.components = from.components;
+			from.id = EntityId{INVALID_ENTITY_INDEX, from.id.version};
+			from.components = 0;
+			aliveEntities.set(hole);
+			aliveEntities.reset(source);
+			queries.update(source, false, 0);
+			queries.update(hole, true, to.components);
+		}
+		// Reused from the lowest index up, so the list stays packed
+		freeEntityIndexes.clear();
+		for(EntityIndex i = entityList.size(); i-- > aliveEntities.count;) {
+			freeEntityIndexes.push_back(i);
+		}
+		profileVisit(moves.size(), 0);
+		LOG_INFO(push, [](std::ostream& os, LogRecord const& r) {
+			os << "Compacted " << r.args[0] << " entities into " << r.args[1] << " of " << r.args[2] << " slots\n";
+		}, moves.size(), aliveEntities.count, entityList.size());
+		return moves;
+	}
+
+	// The living entities having every component of the signature, found by matching the packed signatures
+	// a vector at a time. Only runs of 64 entities with any alive are matched, so the scan follows the living,
+	// and a signature with a rare component only checks the entities having it.
+	EntityBitset scan(Tag signature) {
+		EntityBitset matched;
+		std::vector<Tag> const& signatures = queries.signatures;
+		ComponentId driver = queries.rarest(signature);
+		if (driver != INVALID_COMPONENT_ID && queries.count(driver) * MEMBER_DRIVE_RATIO < aliveEntities.count) {
+			for(EntityIndex i : queries.membersOf(driver)) {
+				if ((signatures[i] & signature) == signature) {
+					matched.set(i);
+				}
+			}
+			return matched;
+		}
+		matched.words.resize(std::min(aliveEntities.words.size(), (signatures.size() + 63) / 64), 0);
+		size_t w = 0;
+		while (w < matched.words.size()) {
+			size_t first = aliveEntities.next(w * 64);
+			if (first == INVALID_ENTITY_INDEX || first / 64 >= matched.words.size()) {
+				break;
+			}
+			w = first / 64;
+			size_t last = w;
+			while (last < matched.words.size() && aliveEntities.words[last] != 0) {
+				last++;
+			}
+			size_t end = std::min(last * 64, signatures.size());
+			matchSignatures(signatures.data() + w * 64, end - w * 64, signature, matched.words.data() + w);
+			w = last;
+		}
+		matched.intersect(aliveEntities);
+		return matched;
+	}
+
+	// Visits the entities scanned as matching when the view was made, skipping those removed or changed since
+	struct View {
+		EntityList& entityList;
+		EntityBitset matched;
+		Tag tag;
+		View(EntityList& _entityList, EntityBitset&& _matched, Tag _tag) : entityList(_entityList), matched(std::move(_matched)), tag(_tag) { }
+
+		struct Iterator {
+			EntityList& entityList;
+			EntityBitset const& matched;
+			Tag tag;
+			Entity * entity;
+			explicit Iterator(EntityList& _entityList, EntityBitset const& _matched, Tag _tag, Entity * _entity) : entityList(_entityList), matched(_matched), tag(_tag), entity(_entity) {
+				LOG_TRACE(push, formatIteratorTrace, (uint64_t)"new Iterator at", entity->id.index, entity->id.version, tag.low());
+			}
+			Entity& operator*() const {
+				LOG_TRACE(push, formatIteratorTrace, (uint64_t)"Dereference iterator returning", entity->id.index, entity->id.version, entity->components.low());
+				return *entity;
+			}
+			bool operator==(Iterator const& other) const {
+				LOG_TRACE(push, formatIteratorTrace, (uint64_t)"Comparing iterator ==", entity->id.index, entity->id.version, entity->components.low());
+				return entity->id.index == other.entity->id.index && entity->id.version == other.entity->id.version;
+			}
+			bool operator!=(Iterator const& other) const {
+				LOG_TRACE(push, formatIteratorTrace, (uint64_t)"Comparing iterator !=", entity->id.index, entity->id.version, entity->components.low());
+				return entity->id.index != other.entity->id.index || entity->id.version != other.entity->id.version;
+			}
+			Iterator& operator++() {
+				if (!entity->isValid()) {
+					return *this;
+				}
+				LOG_TRACE(push, formatIteratorTrace, (uint64_t)"Finding next iterator after", entity->id.index, entity->id.version, entity->components.low());
+				for(size_t i = matched.next(entity->id.index + 1); i != INVALID_ENTITY_INDEX; i = matched.next(i + 1)) {
+					if(entityList[i].isValid() && entityList[i].matchesSignature(tag)) {
+						entity = &entityList[i];
+						LOG_TRACE(push, formatIteratorTrace, (uint64_t)"\tReturning", entity->id.index, entity->id.version, entity->components.low());
+						return *this;
+					}
+				}
+				entity = &INVALID_ENTITY;
+				LOG_TRACE(push, formatIteratorTrace, (uint64_t)"\tReturning", entity->id.index, entity->id.version, entity->components.low());
+				return *this;
+			}
+		};
+		const Iterator begin() const {
+			for(size_t i = matched.next(0); i != INVALID_ENTITY_INDEX; i = matched.next(i + 1)) {
+				Entity& e = entityList[i];
+				if(e.isValid() && e.matchesSignature(tag)) {
+					LOG_TRACE(push, formatIteratorTrace, (uint64_t)"Iterator begin matched", e.id.index, e.id.version, e.components.low());
+					return Iterator(entityList, matched, tag, &e);
+				}
+			}
+			LOG_TRACE(push, formatIteratorTrace, (uint64_t)"Iterator begin matched nothing, returning", INVALID_ENTITY_INDEX, 0, 0);
+			return Iterator(entityList, matched, tag, &INVALID_ENTITY);
+		}
+		const Iterator end() const {
+			return Iterator(entityList, matched, tag, &INVALID_ENTITY);
+		}
+	};
+
+	// Scanning views visit every living entity matching the signature
+	View view(Tag _tag) {
+		profileVisit(entityList.size(), entityList.size() * sizeof(Tag));
+		return View(entityList, scan(_tag), _tag);
+	}
+
+	// Registers a query for the signature on first use, from then on it is updated incrementally
+	Query const& query(Tag signature) {
+		std::lock_guard<std::mutex> lock(queries.mutex);
+		auto it = queries.bySignature.find(signature);
+		if (it != queries.bySignature.end()) {
+			return *it->second;
+		}
+		Query* query = new Query(signature);
+		EntityBitset matched = scan(signature);
+		for(EntityIndex i = matched.next(0); i != INVALID_ENTITY_INDEX; i = matched.next(i + 1)) {
+			query->insert(i);
+		}
+		queries.bySignature[signature] = query;
+		queries.list.push_back(query);
+		LOG_INFO(push, [](std::ostream& os, LogRecord const& r) {
+			os << newStr << ANSI_FG_CYAN_DARK << "Query{" << bits(r.args[0]) << " " << r.args[1] << "}" << ANSI_RESET << "\n";
+		}, signature.low(), query->size());
+		return *query;
+	}
+
+	// Swaps into joined and left the indexes of the entities that started and stopped matching the signature since
+	// the last call, removed ones included, in no order and possibly repeated. An entity may be in both lists and
+	// no longer match or match again. The first call starts keeping them and takes none.
+	void takeChanges(Tag signature, EntityIndexList& joined, EntityIndexList& left) {
+		query(signature);
+		std::lock_guard<std::mutex> lock(queries.mutex);
+		Query* query = queries.bySignature[signature];
+		joined.clear();
+		left.clear();
+		if (query->keepsChanges) {
+			joined.swap(query->joined);
+			left.swap(query->left);
+		}
+		query->keepsChanges = true;
+	}
+
+	struct QueryView {
+		EntityList& entityList;
+		Query const& query;
+
+		struct Iterator {
+			EntityList& entityList;
+			EntityIndex const* index;
+			Entity& operator*() const {
+				return entityList[*index];
+			}
+			bool operator!=(Iterator const& other) const {
+				return index != other.index;
+			}
+			Iterator& operator++() {
+				index++;
+				return *this;
+			}
+		};
+		Iterator begin() const { return Iterator{entityList, query.indexes.data()}; }
+		Iterator end() const { return Iterator{entityList, query.indexes.data() + query.indexes.size()}; }
+	};
+
+	// Iterates the entities of the registered query for the signature, costs time proportional to the matches
+	QueryView matching(Tag signature) {
+		Query const& q = query(signature);
+		profileVisit(q.size(), 0);
+		return QueryView{entityList, q};
+	}
+
+	// Plans a query over the living entities, the types are required components, Optional<> ones or both, and
+	// without<>() adds exclusions. See plan for what it is driven by.
+	template<typename... Ts>
+	PlannedQuery<Ts...> select(Components& components) {
+		return PlannedQuery<Ts...>(entityList, components, queries, aliveEntities);
+	}
+
+	// Typed views in pool storage are driven by the registered query for their signature
+	template<typename... Cs>
+	TypedView<Cs...> view(Components& components) {
+		Tag signature = (tag<Cs>() | ...);
+		return TypedView<Cs...>(entityList, components, components.storage == Storage::Pool ? &query(signature) : nullptr);
+	}
+
+private:
+	// flush() with cachesMutex and every cache's lock held
+	void flushLocked() {
+		if (entityList.size() < nextFresh) {
+			entityList.resize(nextFresh, Entity(INVALID_ENTITY_ID, &queries));
+		}
+		size_t flushed = 0;
+		for(std::unique_ptr<ReserveCache>& cache : caches) {
+			for(EntityId id : cache->reserved) {
+				Entity& e = entityList[id.index];
+				e.id = id;
+				e.components = 0;
+				aliveEntities.set(id.index);
+				e.changed();
+			}
+			flushed += cache->reserved.size();
+			cache->reserved.clear();
+		}
+		if (flushed > 0) {
+			LOG_DEBUG(push, [](std::ostream& os, LogRecord const& r) {
+				os << "Flushed " << r.args[0] << " reserved entities, there are now " << r.args[1] << "\n";
+			}, flushed, entityList.size());
+		}
+	}
+
+	// The calling thread's cache, made on its first reservation
+	ReserveCache& localCache() {
+		struct Local {
+			uint64_t serial;
+			ReserveCache* cache;
+		};
+		thread_local std::vector<Local> locals;
+		for(Local const& local : locals) {
+			if (local.serial == serial) {
+				return *local.cache;
+			}
+		}
+		std::lock_guard<std::mutex> lock(cachesMutex);
+		caches.push_back(std::make_unique<ReserveCache>());
+		locals.push_back(Local{serial, caches.back().get()});
+		return *caches.back();
+	}
+
+	// Stops every reserving thread, hold cachesMutex so no cache is added meanwhile
+	std::vector<std::unique_lock<std::mutex>> lockCaches() {
+		std::vector<std::unique_lock<std::mutex>> locks;
+		for(std::unique_ptr<ReserveCache>& cache : caches) {
+			locks.emplace_back(cache->mutex);
+		}
+		return locks;
+	}
+};
+
+Entity Entities::INVALID_ENTITY(INVALID_ENTITY_ID);
+
+std::ostream &operator<<(std::ostream &os, Entities const& m) {
+	os << ANSI_FG_PINK << "Entities{" << m.list().size() << " " << m.list().size() * sizeof(Entity) << "B " << " [ ";
+	for(auto free : m.freeList()) {
+		os << free << " ";
+	}
+	return os << "]}" << ANSI_RESET;
+}
+
+const EntityVersion PENDING_ENTITY_VERSION(-1);
+
+// Structural changes recorded while iterating, applied in one batch at a sync point.
+// Entities created through the buffer are referred to by pending ids until the buffer is applied. Threads
+// outside of the systems record with ids from Entities::reserve() instead and hand the buffer to Systems::submit().
+struct CommandBuffer {
+	enum class CommandType { Create, Remove, Assign, Unassign };
+
+	struct Command {
+		CommandType type;
+		EntityId entity;
+		void (*apply)(Components& components, Entity& entity, void const* payload);
+		size_t payload; // Offset of the component in data
+	};
+
+	std::vector<Command> commands;
+	std::vector<char> data;
+	size_t creations;
+
+	CommandBuffer() : creations(0) {}
+
+	EntityId create() {
+		EntityId pending{creations++, PENDING_ENTITY_VERSION};
+		commands.push_back(Command{CommandType::Create, pending, nullptr, 0});
+		return pending;
+	}
+
+	void remove(EntityId entity) {
+		commands.push_back(Command{CommandType::Remove, entity, nullptr, 0});
+	}
+
+	template<typename Component>
+	void assign(EntityId entity, Component const& init) {
+		size_t offset = (data.size() + alignof(Component) - 1) / alignof(Component) * alignof(Component);
+		data.resize(offset + sizeof(Component));
+		new (&data[offset]) Component(init);
+		commands.push_back(Command{CommandType::Assign, entity, [](Components& components, Entity& e, void const* payload) {
+			components.assign(e, *(Component const*)payload);
+		}, offset});
+	}
+
+	template<typename Component>
+	void unassign(EntityId entity) {
+		commands.push_back(Command{CommandType::Unassign, entity, [](Components& components, Entity& e, void const* payload) {
+			components.unassign<Component>(e);
+		}, 0});
+	}
+
+	bool empty() const {
+		return commands.empty();
+	}
+
+	void clear() {
+		commands.clear();
+		data.clear();
+		creations = 0;
+	}
+
+	void apply(Entities& entities, Components& components) {
+		apply(this, 1, entities, components);
+	}
+
+	// Flushes reserved entities and creates the pending ones of every buffer, then applies the remaining commands
+	// sorted by entity so each entity's changes happen together and in the order they were recorded
+	static void apply(CommandBuffer* buffers, size_t count, Entities& entities, Components& components) {
+		struct Resolved {
+			EntityId entity;
+			Command const* command;
+			char const* data;
+		};
+		entities.flush();
+		std::vector<Resolved> batch;
+		std::vector<EntityId> created;
+		for(size_t b = 0; b < count; b++) {
+			CommandBuffer& buffer = buffers[b];
+			created.clear();
+			for(Command const& command : buffer.commands) {
+				if (command.type == CommandType::Create) {
+					created.push_back(entities.create().id);
+				}
+			}
+			for(Command const& command : buffer.commands) {
+				if (command.type != CommandType::Create) {
+					EntityId entity = command.entity.version == PENDING_ENTITY_VERSION ? created[command.entity.index] : command.entity;
+					batch.push_back(Resolved{entity, &command, buffer.data.data()});
+				}
+			}
+		}
+		std::stable_sort(batch.begin(), batch.end(), [](Resolved const& a, Resolved const& b) {
+			return a.entity.index < b.entity.index;
+		});
+		for(Resolved const& r : batch) {
+			Entity* e = entities.find(r.entity);
+			if (e == nullptr) {
+				continue;
+			}
+			if (r.command->type == CommandType::Remove) {
+				components.remove(*e);
+				entities.remove(r.entity);
+			} else {
+				r.command->apply(components, *e, r.data + r.command->payload);
+			}
+		}
+		for(size_t b = 0; b < count; b++) {
+			buffers[b].clear();
+		}
+	}
+};
+
+// One buffer per thread of a pool so systems can record without synchronizing
+struct CommandBuffers {
+	ThreadPool& pool;
+	std::vector<CommandBuffer> buffers;
+
+	explicit CommandBuffers(ThreadPool& _pool) : pool(_pool), buffers(_pool.size()) {}
+
+	CommandBuffer& local() {
+		return buffers[pool.index()];
+	}
+
+	void apply(Entities& entities, Components& components) {
+		CommandBuffer::apply(buffers.data(), buffers.size(), entities, components);
+	}
+};
+
+struct System {
+	std::string name;
+	Tag signature;
+	Tag reads;
+	Tag writes;
+	CommandBuffers* commandBuffers;
+	// Tick the current run started at, and that of the previous run, changes since then are new to the system
+	Tick thisRun;
+	Tick lastRun;
+	// Simulated time between runs, zero to run every step, and the simulated time of the next run
+	std::chrono::nanoseconds period;
+	std::chrono::nanoseconds due;
+	// Wall time a run may take, a time-sliced system checks outOfTime() and resumes where it stopped next run
+	std::chrono::nanoseconds budget;
+	std::chrono::steady_clock::time_point deadline;
+
+	// Without declared access a system is assumed to read and write all of its signature
+	System(std::string const& _name, Tag _signature) : System(_name, _signature, _signature, _signature) {}
+	System(std::string const& _name, Tag _signature, Tag _reads, Tag _writes) : name(_name), signature(_signature), reads(_reads), writes(_writes), commandBuffers(nullptr), thisRun(0), lastRun(0), period(0), due(0), budget(0) {}
+
+	virtual void updateAll(Entities& entities, Components& components) = 0;
+
+	// Runs the system at most once per period of simulated time
+	System* every(std::chrono::nanoseconds _period) {
+		period = _period;
+		return this;
+	}
+
+	System* slicedTo(std::chrono::nanoseconds _budget) {
+		budget = _budget;
+		return this;
+	}
+
+	bool outOfTime() const {
+		return budget.count() > 0 && std::chrono::steady_clock::now() >= deadline;
+	}
+
+	// Whether the system runs at the simulated time, moving its next run a period on if so
+	bool dueAt(std::chrono::nanoseconds time) {
+		if (period.count() == 0) {
+			return true;
+		}
+		if (time < due) {
+			return false;
+		}
+		// Periods missed are not made up for
+		due += (time - due) / period * period + period;
+		return true;
+	}
+
+	// Structural changes have to be recorded here, they are applied once every system of the frame has finished
+	CommandBuffer& commands() {
+		return commandBuffers->local();
+	}
+
+	bool conflicts(System const& other) const {
+		return (writes & (other.reads | other.writes)) != 0 || (reads & other.writes) != 0;
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, System const& m) { return os << ANSI_FG_CYAN << "System{" << m.name << " " << bits(m.signature) << " r" << bits(m.reads) << " w" << bits(m.writes) << "}" << ANSI_RESET; }
+
+// Runs systems on a thread pool, a system starts once every earlier added system it conflicts with has finished
+struct Systems {
+	std::vector<System*> systemList;
+	std::vector<std::vector<size_t>> dependents;
+	std::vector<size_t> dependencies;
+	ThreadPool& pool;
+	CommandBuffers commandBuffers;
+	std::mutex submittedMutex;
+	std::vector<CommandBuffer> submitted;
+	std::chrono::nanoseconds time; // Simulated
+
+	explicit Systems(ThreadPool& _pool = ThreadPool::global()) : pool(_pool), commandBuffers(_pool), time(0) {}
+
+	// Hands over a buffer recorded on any thread, it is applied after the systems' own at the end of the next frame
+	void submit(CommandBuffer&& buffer) {
+		std::lock_guard<std::mutex> lock(submittedMutex);
+		submitted.push_back(std::move(buffer));
+	}
+
+	void add(System* system) {
+		size_t i = systemList.size();
+		systemList.push_back(system);
+		system->commandBuffers = &commandBuffers;
+		dependents.push_back({});
+		dependencies.push_back(0);
+		for(size_t j = 0; j < i; j++) {
+			if (systemList[j]->conflicts(*system)) {
+				dependents[j].push_back(i);
+				dependencies[i]++;
+			}
+		}
+		LOG_INFO(pushText, [](std::ostream& os, LogRecord const& r) {
+			os << newStr << ANSI_FG_CYAN << "System{" << r.text() << " " << bits(r.args[0]) << " r" << bits(r.args[1]) << " w" << bits(r.args[2]) << "}" << ANSI_RESET << " after " << r.args[3] << "\n";
+		}, system->name, system->signature.low(), system->reads.low(), system->writes.low(), dependencies[i]);
+	}
+
+	// Runs the systems due after the simulated time moved on by step, systems without a period run every update
+	void update(Entities& entities, Components& components, std::chrono::nanoseconds step = std::chrono::nanoseconds(0)) {
+		ProfileScope scope("frame", "frame");
+		time += step;
+		Frame frame(entities, components, dependencies);
+		for(size_t i = 0; i < systemList.size(); i++) {
+			if (dependencies[i] == 0) {
+				schedule(frame, i);
+			}
+		}
+		pool.wait(frame.group);
+		// Structural changes and changes made between frames are newer than every run of this frame
+		components.advance();
+		{
+			ProfileScope applyScope("apply commands", "frame");
+			commandBuffers.apply(entities, components);
+			std::vector<CommandBuffer> received;
+			{
+				std::lock_guard<std::mutex> lock(submittedMutex);
+				received.swap(submitted);
+			}
+			CommandBuffer::apply(received.data(), received.size(), entities, components);
+		}
+	}
+
+private:
+	struct Frame {
+		Entities& entities;
+		Components& components;
+		TaskGroup group;
+		std::vector<std::atomic<size_t>> remaining;
+		Frame(Entities& _entities, Components& _components, std::vector<size_t> const& dependencies) : entities(_entities), components(_components), remaining(dependencies.size()) {
+			for(size_t i = 0; i < dependencies.size(); i++) {
+				remaining[i] = dependencies[i];
+			}
+		}
+	};
+
+	void schedule(Frame& frame, size_t i) {
+		pool.run(frame.group, [this, &frame, i] {
+			// A system that is not due still lets the systems after it run
+			System& system = *systemList[i];
+			if (system.dueAt(time)) {
+				ProfileScope scope(system.name.c_str(), "system");
+				system.thisRun = frame.components.advance();
+				system.deadline = std::chrono::steady_clock::now() + system.budget;
+				system.updateAll(frame.entities, frame.components);
+				system.lastRun = system.thisRun;
+			}
+			for(size_t d : dependents[i]) {
+				if (--frame.remaining[d] == 0) {
+					schedule(frame, d);
+				}
+			}
+		});
+	}
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <vector>
+#include "ecs.h"
+#include "world.h"
+
+// Pipelining the simulation with rendering or exporting: the state of selected components is published at the end
+// of every frame and read on another thread while the next frame simulates.
+
+// The components Cs and the signatures of every entity at the end of a frame, laid out by entity index
+template<typename... Cs>
+struct FrameState {
+	Tick tick; // Changes from this tick on are not in the state
+	std::vector<Tag> signatures;
+	std::array<std::vector<char>, sizeof...(Cs)> columns;
+
+	FrameState() : tick(0) {}
+
+	size_t size() const {
+		return signatures.size();
+	}
+
+	template<typename C>
+	C const* get(EntityIndex i) const {
+		constexpr ComponentId column = componentIndex<C, Cs...>();
+		static_assert(column != INVALID_COMPONENT_ID, "The component is not part of the state");
+		if (i >= signatures.size() || !signatures[i].test(id<C>())) {
+			return nullptr;
+		}
+		return reinterpret_cast<C const*>(columns[column].data()) + i;
+	}
+
+	// Calls fn(EntityIndex, Qs const&...) for every entity having all of Qs
+	template<typename... Qs, typename F>
+	void each(F&& fn) const {
+		Tag signature = (tag<Qs>() | ...);
+		for(EntityIndex i = 0; i < signatures.size(); i++) {
+			if ((signatures[i] & signature) == signature) {
+				fn(i, *get<Qs>(i)...);
+			}
+		}
+	}
+};
+
+// Triple buffered so neither side waits: publish() fills the back state while the reader holds the front one,
+// and both hand states over by exchanging indexes. A state is brought up to date by copying just the components
+// changed since it was last filled, from pool slots by their ticks or from archetype chunks by theirs.
+template<typename... Cs>
+struct FrameStates {
+	static const uint8_t FRESH = 4; // Set on ready until a reader takes it
+	std::array<FrameState<Cs...>, 3> states;
+	uint8_t back;
+	std::atomic<uint8_t> ready;
+	uint8_t front;
+
+	FrameStates() : back(0), ready(1), front(2) {}
+
+	// Call from the simulation's thread between frames
+	void publish(Entities& entities, Components& components) {
+		ProfileScope scope("publish", "frame");
+		FrameState<Cs...>& state = states[back];
+		// Changes from now on are newer than the state
+		Tick now = components.advance();
+		state.signatures = entities.signatures();
+		(copyChanged<Cs>(components, state), ...);
+		state.tick = now;
+		back = ready.exchange(back | FRESH) & ~FRESH;
+	}
+
+	// The newest published state, it stays unchanged until the next call. Call from one reader thread.
+	FrameState<Cs...> const& latest() {
+		if ((ready.load(std::memory_order_relaxed) & FRESH) != 0) {
+			front = ready.exchange(front) & ~FRESH;
+		}
+		return states[front];
+	}
+
+private:
+	template<typename C>
+	void copyChanged(Components& components, FrameState<Cs...>& state) {
+		ComponentId componentId = id<C>();
+		std::vector<char>& column = state.columns[componentIndex<C, Cs...>()];
+		if (column.size() < state.signatures.size() * sizeof(C)) {
+			column.resize(state.signatures.size() * sizeof(C));
+		}
+		char* slots = column.data();
+		if (components.storage == Storage::Archetype) {
+			for(auto& [signature, archetype] : components.archetypes) {
+				if (!archetype->has(componentId)) {
+					continue;
+				}
+				for(size_t chunk = 0; chunk < archetype->chunks.size(); chunk++) {
+					if (archetype->changedTick(componentId, chunk) < state.tick) {
+						continue;
+					}
+					EntityIndex const* indexes = archetype->entities(chunk);
+					char const* values = (char const*)archetype->column(componentId, chunk);
+					for(size_t row = 0; row < archetype->rows(chunk); row++) {
+						memcpy(slots + indexes[row] * sizeof(C), values + row * sizeof(C), sizeof(C));
+					}
+				}
+			}
+			return;
+		}
+		C const* pool = components.pool<C>();
+		if (pool == nullptr) {
+			return;
+		}
+		std::vector<Tick> const& ticks = components.changedTicks[componentId];
+		size_t n = std::min(ticks.size(), state.signatures.size());
+		for(EntityIndex i = 0; i < n; i++) {
+			if (ticks[i] >= state.tick && state.signatures[i].test(componentId)) {
+				memcpy(slots + i * sizeof(C), &pool[i], sizeof(C));
+			}
+		}
+	}
+};
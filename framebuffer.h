@@ -0,0 +1,195 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "ecs.h"
+
+// A headless grid of character cells the world is drawn into, and a terminal writer that sends only the cells that
+// differ from what it wrote last, as cursor moves, colour changes and characters in one write per frame.
+
+struct Cell {
+	char glyph;
+	Color color;
+
+	bool operator==(Cell const& other) const {
+		return glyph == other.glyph && color.r == other.color.r && color.g == other.color.g && color.b == other.color.b;
+	}
+	bool operator!=(Cell const& other) const {
+		return !(*this == other);
+	}
+};
+
+static_assert(sizeof(Cell) == 4, "Rows of cells are compared with memcmp, so cells have no padding");
+
+const Cell BLANK_CELL{' ', Color{0, 0, 0}};
+// Never drawn, what the writer assumes is on screen before its first frame
+const Cell UNKNOWN_CELL{'\0', Color{0, 0, 0}};
+
+struct Framebuffer {
+	size_t width;
+	size_t height;
+	Vec3 center; // World position at the middle of the grid
+	Z scale; // World units per column, a row covers twice that as cells are about twice as tall as wide
+	std::vector<Cell> cells; // Row major
+
+	Framebuffer(size_t _width = 80, size_t _height = 24, Z _scale = 10) : width(0), height(0), center{0, 0, 0}, scale(_scale) {
+		resize(_width, _height);
+	}
+
+	void resize(size_t _width, size_t _height) {
+		width = _width;
+		height = _height;
+		cells.assign(width * height, BLANK_CELL);
+	}
+
+	void clear() {
+		std::fill(cells.begin(), cells.end(), BLANK_CELL);
+	}
+
+	Cell const& at(size_t x, size_t y) const {
+		return cells[y * width + x];
+	}
+
+	// Draws a point of the world in its cell, a cell drawn twice in a frame shows as crowded. Returns false
+	// when the point is outside the grid.
+	bool plot(Vec3 const& pos, Color color) {
+		Z column = std::floor((pos.x - center.x) / scale + width / 2.0f);
+		Z row = std::floor((center.y - pos.y) / (2 * scale) + height / 2.0f);
+		if (!(column >= 0 && column < width && row >= 0 && row < height)) {
+			return false;
+		}
+		Cell& cell = cells[(size_t)row * width + (size_t)column];
+		cell = Cell{cell.glyph == BLANK_CELL.glyph ? 'o' : '#', color};
+		return true;
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, Framebuffer const& m) { return os << ANSI_FG_BLUE << "Framebuffer{" << m.width << "x" << m.height << " " << m.scale << " per cell}" << ANSI_RESET; }
+
+// Columns and rows of the terminal on fd, the defaults when it is not a terminal
+void terminalSize(int fd, size_t& width, size_t& height) {
+	winsize size{};
+	if (ioctl(fd, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0) {
+		width = size.ws_col;
+		height = size.ws_row;
+	}
+}
+
+struct TerminalWriter {
+	int fd;
+	size_t width;
+	size_t height;
+	std::vector<Cell> shown; // What the terminal shows, as written by the last present
+	std::string out; // Kept between frames for its capacity
+	size_t cells; // Written by the last present
+	size_t bytes;
+
+	explicit TerminalWriter(int _fd = STDOUT_FILENO) : fd(_fd), width(0), height(0), cells(0), bytes(0) {}
+
+	// Forgets what the terminal shows, the next present redraws every cell
+	void invalidate() {
+		std::fill(shown.begin(), shown.end(), UNKNOWN_CELL);
+	}
+
+	// Brings the terminal from the last frame presented to this one
+	void present(Framebuffer const& frame) {
+		ProfileScope scope("present", "render");
+		out.clear();
+		if (frame.width != width || frame.height != height) {
+			width = frame.width;
+			height = frame.height;
+			shown.assign(width * height, UNKNOWN_CELL);
+			out += "\033[2J";
+		}
+		cells = 0;
+		bool colored = false;
+		Color color{0, 0, 0};
+		// Where the next character goes, unknown until the first cursor move
+		size_t cursorX = width;
+		size_t cursorY = height;
+		for(size_t y = 0; y < height; y++) {
+			if (memcmp(&frame.cells[y * width], &shown[y * width], width * sizeof(Cell)) == 0) {
+				continue;
+			}
+			for(size_t x = 0; x < width; x++) {
+				Cell const& cell = frame.at(x, y);
+				Cell& old = shown[y * width + x];
+				if (cell == old) {
+					continue;
+				}
+				if (y != cursorY) {
+					moveTo(x, y);
+				} else if (x != cursorX) {
+					moveRight(x - cursorX);
+				}
+				if (!colored || cell.color.r != color.r || cell.color.g != color.g || cell.color.b != color.b) {
+					setColor(cell.color);
+					color = cell.color;
+					colored = true;
+				}
+				out += cell.glyph;
+				// The cursor stays put after the last column
+				cursorX = x + 1 < width ? x + 1 : width;
+				cursorY = x + 1 < width ? y : height;
+				old = cell;
+				cells++;
+			}
+		}
+		if (out.empty()) {
+			bytes = 0;
+			return;
+		}
+		out += ANSI_RESET;
+		bytes = out.size();
+		profileVisit(cells, bytes);
+		for(size_t written = 0; written < out.size();) {
+			ssize_t n = write(fd, out.data() + written, out.size() - written);
+			if (n <= 0) {
+				perror("TerminalWriter write");
+				return;
+			}
+			written += n;
+		}
+	}
+
+private:
+	void number(size_t n) {
+		char digits[20];
+		size_t i = sizeof(digits);
+		do {
+			digits[--i] = '0' + n % 10;
+			n /= 10;
+		} while (n > 0);
+		out.append(digits + i, sizeof(digits) - i);
+	}
+
+	void moveTo(size_t x, size_t y) {
+		out += "\033[";
+		number(y + 1);
+		out += ';';
+		number(x + 1);
+		out += 'H';
+	}
+
+	void moveRight(size_t n) {
+		out += "\033[";
+		number(n);
+		out += 'C';
+	}
+
+	// 24 bit colour, the foreground of the glyph
+	void setColor(Color c) {
+		out += "\033[38;2;";
+		number(c.r);
+		out += ';';
+		number(c.g);
+		out += ';';
+		number(c.b);
+		out += 'm';
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, TerminalWriter const& m) { return os << ANSI_FG_BLUE << "TerminalWriter{" << m.cells << " cells " << m.bytes << "B}" << ANSI_RESET; }
@@ -0,0 +1,272 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "ecs.h"
+
+// Parent/child relationships between entities. The nodes are kept breadth first, roots then every depth in turn,
+// so a parent's row always comes before its children's and a cascade down the tree is one pass over the rows,
+// with the rows of a depth independent of each other. The order is rebuilt lazily after the tree changes.
+
+const size_t NO_ROW(-1);
+// Rows ahead whose entity and components are fetched while propagating, the entity indexes of a depth are scattered
+const size_t PROPAGATE_PREFETCH = 8;
+
+struct Hierarchy {
+	struct Link {
+		EntityId child;
+		EntityId parent;
+	};
+
+	std::vector<Link> links; // Indexed by the child's entity index
+	std::vector<EntityId> nodes; // Breadth first
+	std::vector<size_t> parentRows; // NO_ROW for the roots
+	std::vector<size_t> levels; // First row of each depth, then the end
+	std::vector<Vec3> world; // Position of each row while propagating
+	std::vector<EntityId> orphans; // Living entities that lost an ancestor, left for the owner to remove
+	bool dirty;
+
+	Hierarchy() : dirty(false) {}
+
+	// Makes child a child of parent, refused if parent is child itself or one of its descendants
+	bool attach(EntityId child, EntityId parent) {
+		for(EntityId up = parent; up.isValid(); up = parentOf(up)) {
+			if (up == child) {
+				return false;
+			}
+		}
+		if (links.size() <= child.index) {
+			links.resize(child.index + 1, Link{INVALID_ENTITY_ID, INVALID_ENTITY_ID});
+		}
+		links[child.index] = Link{child, parent};
+		dirty = true;
+		return true;
+	}
+
+	// Makes the child a root, its own children stay with it
+	void detach(EntityId child) {
+		if (parentOf(child).isValid()) {
+			links[child.index] = Link{INVALID_ENTITY_ID, INVALID_ENTITY_ID};
+			dirty = true;
+		}
+	}
+
+	EntityId parentOf(EntityId child) const {
+		if (child.index >= links.size() || links[child.index].child != child) {
+			return INVALID_ENTITY_ID;
+		}
+		return links[child.index].parent;
+	}
+
+	size_t depth() const {
+		return levels.empty() ? 0 : levels.size() - 1;
+	}
+
+	// Removes the entity together with every descendant, in one batch
+	void removeSubtree(Entities& entities, Components& components, EntityId root) {
+		ProfileScope scope("removeSubtree", "structural");
+		Entity* e = entities.find(root);
+		if (e == nullptr) {
+			return;
+		}
+		components.remove(*e);
+		entities.remove(root);
+		dirty = true;
+		update(entities);
+		std::sort(orphans.begin(), orphans.end(), [](EntityId const& a, EntityId const& b) {
+			return a.index < b.index;
+		});
+		for(EntityId orphan : orphans) {
+			Entity* o = entities.find(orphan);
+			if (o != nullptr) {
+				components.remove(*o);
+				entities.remove(orphan);
+			}
+		}
+		orphans.clear();
+	}
+
+	// Compaction gave the moved entities new ids
+	void moved(std::vector<EntityMove> const& moves) {
+		// By the index moved from, the versions telling the moved entity from a removed one that held the index
+		std::unordered_map<EntityIndex, EntityMove> from;
+		std::unordered_set<EntityIndex> holes;
+		for(EntityMove const& move : moves) {
+			from[move.from.index] = move;
+			holes.insert(move.to.index);
+		}
+		auto remap = [&](EntityId id) {
+			auto it = from.find(id.index);
+			return it != from.end() && it->second.from == id ? it->second.to : id;
+		};
+		std::vector<Link> old;
+		old.swap(links);
+		for(Link const& link : old) {
+			// Entities were only moved into holes, so an unmoved link there is of a removed one
+			bool overwritten = remap(link.child) == link.child && holes.count(link.child.index) > 0;
+			if (link.child.isValid() && !overwritten) {
+				attach(remap(link.child), remap(link.parent));
+			}
+		}
+		dirty = true;
+	}
+
+	// Orders the nodes breadth first again. Links whose child or any ancestor was removed are dropped, the
+	// living entities among them are added to orphans.
+	void update(Entities& entities) {
+		if (!dirty) {
+			return;
+		}
+		ProfileScope scope("hierarchy", "structural");
+		dirty = false;
+		const int64_t UNKNOWN = -1;
+		const int64_t ORPHANED = -2;
+		// Depth of each child, found walking up until an ancestor of known depth or a root
+		std::vector<int64_t> depths(links.size(), UNKNOWN);
+		std::vector<EntityIndex> path;
+		int64_t deepest = 0;
+		for(EntityIndex i = 0; i < links.size(); i++) {
+			if (!links[i].child.isValid() || depths[i] != UNKNOWN) {
+				continue;
+			}
+			EntityIndex j = i;
+			path.clear();
+			while (isChild(links[j].child) && depths[j] == UNKNOWN) {
+				path.push_back(j);
+				EntityId parent = links[j].parent;
+				if (!isChild(parent)) {
+					break;
+				}
+				j = parent.index;
+			}
+			for(size_t k = path.size(); k-- > 0;) {
+				Link const& link = links[path[k]];
+				int64_t above = isChild(link.parent) ? depths[link.parent.index] : entities.find(link.parent) != nullptr ? 0 : ORPHANED;
+				depths[path[k]] = above == ORPHANED || entities.find(link.child) == nullptr ? ORPHANED : above + 1;
+				deepest = std::max(deepest, depths[path[k]]);
+			}
+		}
+		// Rows by counting sort on depth, the roots being the parents at depth 0
+		std::vector<size_t> counts(deepest + 2, 0);
+		std::vector<size_t> rows(entities.size(), NO_ROW);
+		std::vector<EntityId> roots;
+		for(EntityIndex i = 0; i < links.size(); i++) {
+			if (depths[i] == ORPHANED) {
+				if (entities.find(links[i].child) != nullptr) {
+					orphans.push_back(links[i].child);
+				}
+				links[i] = Link{INVALID_ENTITY_ID, INVALID_ENTITY_ID};
+			} else if (depths[i] != UNKNOWN) {
+				counts[depths[i]]++;
+				if (depths[i] == 1 && rows[links[i].parent.index] == NO_ROW) {
+					rows[links[i].parent.index] = roots.size();
+					roots.push_back(links[i].parent);
+				}
+			}
+		}
+		counts[0] = roots.size();
+		levels.assign(1, 0);
+		for(size_t d = 0; d < counts.size() && counts[d] > 0; d++) {
+			levels.push_back(levels.back() + counts[d]);
+		}
+		nodes.resize(levels.back());
+		std::copy(roots.begin(), roots.end(), nodes.begin());
+		std::vector<size_t> next(levels.begin(), levels.end() - 1);
+		for(EntityIndex i = 0; i < links.size(); i++) {
+			if (depths[i] > 0) {
+				size_t row = next[depths[i]]++;
+				nodes[row] = links[i].child;
+				rows[i] = row;
+			}
+		}
+		parentRows.resize(nodes.size());
+		for(size_t row = 0; row < nodes.size(); row++) {
+			parentRows[row] = row < roots.size() ? NO_ROW : rows[links[nodes[row].index].parent.index];
+		}
+		LOG_DEBUG(push, [](std::ostream& os, LogRecord const& r) {
+			os << "Hierarchy of " << r.args[0] << " nodes " << r.args[1] << " deep, " << r.args[2] << " orphaned\n";
+		}, nodes.size(), depth(), orphans.size());
+	}
+
+	// Sets the Position of every descendant to its parent's plus its LocalPosition, a depth at a time with the
+	// rows of a wide depth spread over the pool's threads. A removed node is noticed here and orphans its subtree
+	// on the next update.
+	void propagate(Entities& entities, Components& components, size_t grainSize = 1024, ThreadPool& threads = ThreadPool::global()) {
+		update(entities);
+		ProfileScope scope("propagate", "system");
+		profileVisit(nodes.size(), nodes.size() * (sizeof(Position) + sizeof(LocalPosition)));
+		EntityList const& list = entities.list();
+		world.resize(nodes.size());
+		std::atomic<bool> stale(false);
+		// Ticks are shared by whole chunks in archetype storage, so there they are marked from one thread afterwards
+		bool pooled = components.storage == Storage::Pool;
+		ComponentId position = id<Position>();
+		Position* positions = pooled ? components.pool<Position>() : nullptr;
+		LocalPosition* locals = pooled ? components.pool<LocalPosition>() : nullptr;
+		auto propagateRows = [&](size_t begin, size_t end) {
+			for(size_t row = begin; row < end; row++) {
+				if (row + PROPAGATE_PREFETCH < end) {
+					EntityIndex ahead = nodes[row + PROPAGATE_PREFETCH].index;
+					__builtin_prefetch(&list[ahead]);
+					if (positions != nullptr && locals != nullptr) {
+						__builtin_prefetch(&positions[ahead], 1);
+						__builtin_prefetch(&locals[ahead]);
+					}
+				}
+				Entity const& e = list[nodes[row].index];
+				size_t parent = parentRows[row];
+				Vec3 base = parent == NO_ROW ? Vec3{0, 0, 0} : world[parent];
+				if (e.id != nodes[row]) {
+					stale.store(true, std::memory_order_relaxed);
+					world[row] = base;
+					continue;
+				}
+				Position* p = components.get<Position>(e);
+				if (parent == NO_ROW) {
+					world[row] = p != nullptr ? p->pos : base;
+					continue;
+				}
+				LocalPosition const* local = components.get<LocalPosition>(e);
+				world[row] = local != nullptr ? Vec3{base.x + local->pos.x, base.y + local->pos.y, base.z + local->pos.z} : base;
+				if (p != nullptr) {
+					p->pos = world[row];
+					if (pooled) {
+						components.markChanged(e, position);
+					}
+				}
+			}
+		};
+		// Runs of narrow depths go on this thread in one pass, the rows of a parent still come first
+		size_t d = 0;
+		while (d + 1 < levels.size()) {
+			size_t first = levels[d];
+			while (d + 1 < levels.size() && levels[d + 1] - levels[d] <= grainSize) {
+				d++;
+			}
+			propagateRows(first, levels[d]);
+			if (d + 1 < levels.size()) {
+				parallelFor(threads, levels[d], levels[d + 1], grainSize, propagateRows);
+				d++;
+			}
+		}
+		if (!pooled) {
+			for(size_t row = 0; row < nodes.size(); row++) {
+				Entity const& e = list[nodes[row].index];
+				if (parentRows[row] != NO_ROW && e.id == nodes[row] && components.get<Position>(e) != nullptr) {
+					components.markChanged(e, position);
+				}
+			}
+		}
+		if (stale) {
+			dirty = true;
+		}
+	}
+
+private:
+	bool isChild(EntityId id) const {
+		return id.isValid() && id.index < links.size() && links[id.index].child == id;
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, Hierarchy const& m) { return os << ANSI_FG_GREEN << "Hierarchy{" << m.nodes.size() << " nodes " << m.depth() << " deep}" << ANSI_RESET; }
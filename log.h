@@ -0,0 +1,216 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <string>
+#include <algorithm>
+
+// Levels below LOG_LEVEL compile to nothing. Enabled events are pushed as fixed size binary records into a
+// lock free ring buffer and formatted to stderr by a background thread, so the hot path never touches iostreams.
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_OFF   4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+const size_t LOG_PAYLOAD_SIZE = 32;
+const size_t LOG_RING_SIZE = 1 << 14;
+
+struct LogRecord;
+typedef void (*LogFormat)(std::ostream& os, LogRecord const& record);
+
+struct LogRecord {
+	uint64_t nanos;
+	LogFormat format;
+	uint64_t args[4];
+	alignas(16) char payload[LOG_PAYLOAD_SIZE];
+
+	template<typename T>
+	T const& value() const {
+		return *(T const*)payload;
+	}
+
+	char const* text() const {
+		return payload;
+	}
+};
+
+// Bounded multi producer single consumer queue, producers never block and drop records when it is full
+struct LogRing {
+	struct Cell {
+		std::atomic<size_t> sequence;
+		LogRecord record;
+	};
+
+	std::vector<Cell> cells;
+	size_t mask;
+	std::atomic<size_t> enqueuePos;
+	size_t dequeuePos;
+
+	explicit LogRing(size_t size) : cells(size), mask(size - 1), enqueuePos(0), dequeuePos(0) {
+		for(size_t i = 0; i < size; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool push(LogRecord const& record) {
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true) {
+			cell = &cells[pos & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)sequence - (intptr_t)pos;
+			if (dif == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->record = record;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(LogRecord& record) {
+		Cell& cell = cells[dequeuePos & mask];
+		if (cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+			return false;
+		}
+		record = cell.record;
+		cell.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+		dequeuePos++;
+		return true;
+	}
+};
+
+struct Logger {
+	LogRing ring;
+	std::atomic<size_t> dropped;
+	std::atomic<bool> stopping;
+	std::chrono::steady_clock::time_point start;
+	std::thread thread;
+
+	Logger() : ring(LOG_RING_SIZE), dropped(0), stopping(false), start(std::chrono::steady_clock::now()) {
+		thread = std::thread([this] {
+			while (!stopping) {
+				if (drain() == 0) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+			}
+			drain();
+		});
+	}
+
+	~Logger() {
+		stopping = true;
+		thread.join();
+	}
+
+	void push(LogFormat format, uint64_t a0 = 0, uint64_t a1 = 0, uint64_t a2 = 0, uint64_t a3 = 0) {
+		LogRecord record;
+		record.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		record.format = format;
+		record.args[0] = a0;
+		record.args[1] = a1;
+		record.args[2] = a2;
+		record.args[3] = a3;
+		push(record);
+	}
+
+	// Copies the value into the record, so it is formatted as it was when logged
+	template<typename T>
+	void pushValue(LogFormat format, T const& value, uint64_t a0 = 0, uint64_t a1 = 0, uint64_t a2 = 0, uint64_t a3 = 0) {
+		static_assert(std::is_trivially_copyable<T>::value && sizeof(T) <= LOG_PAYLOAD_SIZE, "Logged values are copied as raw bytes");
+		LogRecord record;
+		record.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		record.format = format;
+		record.args[0] = a0;
+		record.args[1] = a1;
+		record.args[2] = a2;
+		record.args[3] = a3;
+		memcpy(record.payload, &value, sizeof(T));
+		push(record);
+	}
+
+	// Copies at most LOG_PAYLOAD_SIZE - 1 characters of the text
+	void pushText(LogFormat format, std::string const& text, uint64_t a0 = 0, uint64_t a1 = 0, uint64_t a2 = 0, uint64_t a3 = 0) {
+		LogRecord record;
+		record.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		record.format = format;
+		record.args[0] = a0;
+		record.args[1] = a1;
+		record.args[2] = a2;
+		record.args[3] = a3;
+		size_t n = std::min(text.size(), LOG_PAYLOAD_SIZE - 1);
+		memcpy(record.payload, text.data(), n);
+		record.payload[n] = 0;
+		push(record);
+	}
+
+private:
+	void push(LogRecord const& record) {
+		if (!ring.push(record)) {
+			dropped++;
+		}
+	}
+
+	size_t drain() {
+		std::ostringstream os;
+		LogRecord record;
+		size_t n = 0;
+		while (n < 1024 && ring.pop(record)) {
+			record.format(os, record);
+			n++;
+		}
+		size_t lost = dropped.exchange(0);
+		if (lost > 0) {
+			os << "dropped " << lost << " log records\n";
+		}
+		std::string const& out = os.str();
+		fwrite(out.data(), 1, out.size(), stderr);
+		return n;
+	}
+};
+
+Logger& logger() {
+	static Logger instance;
+	return instance;
+}
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(method, ...) logger().method(__VA_ARGS__)
+#else
+#define LOG_TRACE(method, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(method, ...) logger().method(__VA_ARGS__)
+#else
+#define LOG_DEBUG(method, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(method, ...) logger().method(__VA_ARGS__)
+#else
+#define LOG_INFO(method, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(method, ...) logger().method(__VA_ARGS__)
+#else
+#define LOG_WARN(method, ...) ((void)0)
+#endif
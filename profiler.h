@@ -0,0 +1,221 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Instrumentation of systems and structural operations. While disabled a scope costs one relaxed load, while
+// enabled every scope appends an event to a ring owned by the recording thread, so recording never takes a lock.
+// The recorded events are read through stats() and writeTrace(), which must not overlap a frame.
+
+const size_t PROFILE_BUFFER_EVENTS = 1 << 16;
+const size_t PROFILE_STATS_WINDOW = 120;
+
+struct ProfileEvent {
+	char const* name; // Has to outlive the profiler's events, string literals and system names do
+	char const* category;
+	uint64_t start; // Nanoseconds since the profiler was created
+	uint64_t duration;
+	uint64_t entities;
+	uint64_t bytes;
+};
+
+// Events recorded by one thread, the oldest are overwritten once it is full
+struct ProfileBuffer {
+	uint32_t thread;
+	std::vector<ProfileEvent> events;
+	size_t next;
+	// Running totals of the thread, a scope records how much they grew while it was open
+	uint64_t entities;
+	uint64_t bytes;
+
+	explicit ProfileBuffer(uint32_t _thread) : thread(_thread), next(0), entities(0), bytes(0) {
+		events.reserve(PROFILE_BUFFER_EVENTS);
+	}
+
+	void push(ProfileEvent const& event) {
+		if (events.size() < PROFILE_BUFFER_EVENTS) {
+			events.push_back(event);
+		} else {
+			events[next] = event;
+		}
+		next = (next + 1) % PROFILE_BUFFER_EVENTS;
+	}
+};
+
+struct ProfileStats {
+	std::string name;
+	std::string category;
+	size_t samples;
+	double mean; // Nanoseconds
+	double p99;
+	double entities; // Mean per sample
+	double bytes;
+};
+
+struct Profiler {
+	std::atomic<bool> enabled;
+	std::chrono::steady_clock::time_point start;
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ProfileBuffer>> buffers;
+	inline static thread_local ProfileBuffer* currentBuffer = nullptr;
+
+	Profiler() : enabled(false), start(std::chrono::steady_clock::now()) {}
+
+	bool isEnabled() const {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void enable(bool on = true) {
+		enabled.store(on, std::memory_order_relaxed);
+	}
+
+	uint64_t now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	ProfileBuffer& local() {
+		if (currentBuffer == nullptr) {
+			std::lock_guard<std::mutex> lock(mutex);
+			buffers.push_back(std::make_unique<ProfileBuffer>(buffers.size()));
+			currentBuffer = buffers.back().get();
+		}
+		return *currentBuffer;
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		for(auto& buffer : buffers) {
+			buffer->events.clear();
+			buffer->next = 0;
+		}
+	}
+
+	// Rolling mean and p99 over the last window events of every name in the category, or all categories given nullptr
+	std::vector<ProfileStats> stats(char const* category = "system", size_t window = PROFILE_STATS_WINDOW) {
+		std::vector<ProfileEvent> events = collect();
+		std::vector<ProfileStats> result;
+		std::vector<char const*> names;
+		for(ProfileEvent const& event : events) {
+			if ((category == nullptr || strcmp(event.category, category) == 0) && std::find_if(names.begin(), names.end(), [&](char const* n) { return strcmp(n, event.name) == 0; }) == names.end()) {
+				names.push_back(event.name);
+			}
+		}
+		for(char const* name : names) {
+			std::vector<uint64_t> durations;
+			ProfileStats s{name, "", 0, 0, 0, 0, 0};
+			for(auto it = events.rbegin(); it != events.rend() && durations.size() < window; ++it) {
+				if (strcmp(it->name, name) == 0 && (category == nullptr || strcmp(it->category, category) == 0)) {
+					s.category = it->category;
+					durations.push_back(it->duration);
+					s.mean += it->duration;
+					s.entities += it->entities;
+					s.bytes += it->bytes;
+				}
+			}
+			s.samples = durations.size();
+			s.mean /= s.samples;
+			s.entities /= s.samples;
+			s.bytes /= s.samples;
+			std::sort(durations.begin(), durations.end());
+			s.p99 = durations[(s.samples * 99 + 99) / 100 - 1];
+			result.push_back(s);
+		}
+		return result;
+	}
+
+	// Chrome trace_event format, loadable in chrome://tracing and Perfetto
+	void writeTrace(std::ostream& os) {
+		std::lock_guard<std::mutex> lock(mutex);
+		os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+		bool first = true;
+		for(auto& buffer : buffers) {
+			for(ProfileEvent const& event : buffer->events) {
+				os << (first ? "" : ",\n") << "{\"name\": \"";
+				writeEscaped(os, event.name);
+				os << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread
+					<< ", \"ts\": " << event.start / 1000.0 << ", \"dur\": " << event.duration / 1000.0
+					<< ", \"args\": {\"entities\": " << event.entities << ", \"bytes\": " << event.bytes << "}}";
+				first = false;
+			}
+		}
+		os << "\n]}\n";
+	}
+
+	bool writeTrace(std::string const& path) {
+		std::ofstream file(path);
+		writeTrace(file);
+		return file.good();
+	}
+
+private:
+	// Events of every thread ordered by start
+	std::vector<ProfileEvent> collect() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<ProfileEvent> events;
+		for(auto& buffer : buffers) {
+			events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+		}
+		std::sort(events.begin(), events.end(), [](ProfileEvent const& a, ProfileEvent const& b) { return a.start < b.start; });
+		return events;
+	}
+
+	static void writeEscaped(std::ostream& os, char const* text) {
+		for(; *text != 0; text++) {
+			if (*text == '"' || *text == '\\') {
+				os << '\\';
+			}
+			os << *text;
+		}
+	}
+};
+
+Profiler& profiler() {
+	static Profiler instance;
+	return instance;
+}
+
+// Counts entities and component bytes touched towards the scopes open on this thread
+inline void profileVisit(uint64_t entities, uint64_t bytes) {
+	if (profiler().isEnabled()) {
+		ProfileBuffer& buffer = profiler().local();
+		buffer.entities += entities;
+		buffer.bytes += bytes;
+	}
+}
+
+// Records the time between construction and destruction, if the profiler was enabled at construction
+struct ProfileScope {
+	char const* name;
+	char const* category;
+	ProfileBuffer* buffer;
+	uint64_t start;
+	uint64_t entities;
+	uint64_t bytes;
+
+	ProfileScope(char const* _name, char const* _category) : name(_name), category(_category), buffer(nullptr) {
+		if (profiler().isEnabled()) {
+			buffer = &profiler().local();
+			entities = buffer->entities;
+			bytes = buffer->bytes;
+			start = profiler().now();
+		}
+	}
+
+	ProfileScope(ProfileScope const&) = delete;
+	ProfileScope& operator=(ProfileScope const&) = delete;
+
+	~ProfileScope() {
+		if (buffer != nullptr) {
+			uint64_t end = profiler().now();
+			buffer->push(ProfileEvent{name, category, start, end - start, buffer->entities - entities, buffer->bytes - bytes});
+		}
+	}
+};
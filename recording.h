@@ -0,0 +1,547 @@
+#pragma once
+#include <cstdio>
+#include <limits>
+#include "ecs.h"
+#include "snapshot.h"
+#include "hierarchy.h"
+
+// Frame by frame recording of a world for reproducing runs. Each frame stores the length of the entity list, the
+// entities whose id or signature changed, the free list and the hierarchy's links when they changed, the generator's
+// state and, for every component slot changed since the
+// previous frame, its bytes XORed with the previous ones. Unchanged bytes XOR to zero, so runs of zeros are
+// encoded as lengths. Every KEYFRAME_INTERVAL frames the whole world is stored instead, a replay starts from the
+// last keyframe before the frame it wants and applies the frames after it, without simulating anything.
+
+const char RECORDING_MAGIC[8] = {'E', 'C', 'S', 'R', 'E', 'C', '0', '2'};
+const size_t KEYFRAME_INTERVAL = 64;
+// In place of the count of the free list or of the links when they are as in the previous frame
+const uint64_t FREE_LIST_UNCHANGED = std::numeric_limits<uint64_t>::max();
+const uint64_t LINKS_UNCHANGED = std::numeric_limits<uint64_t>::max();
+
+struct RecordingHeader {
+	char magic[8];
+	uint64_t seed;
+	uint64_t signatureWords;
+};
+
+// Followed by its new components' SnapshotComponent (offset and length unused), then the encoded payload
+struct RecordingFrame {
+	uint64_t frame;
+	uint64_t keyframe;
+	uint64_t newComponents;
+	uint64_t payloadSize; // Encoded
+	uint64_t decodedSize;
+};
+
+struct RecordingEntity {
+	uint64_t slot;
+	SnapshotEntity id;
+	Tag signature;
+};
+
+struct RecordingLink {
+	SnapshotEntity child;
+	SnapshotEntity parent;
+
+	bool operator==(RecordingLink const& other) const {
+		return child.index == other.child.index && child.version == other.child.version && parent.index == other.parent.index && parent.version == other.parent.version;
+	}
+};
+
+// Alternating runs of zeros and literal bytes, each run preceded by its length as a varint
+void putVarint(std::vector<char>& out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((char)v);
+}
+
+bool getVarint(char const*& p, char const* end, uint64_t& v) {
+	v = 0;
+	for(int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t b = *p++;
+		v |= uint64_t(b & 0x7F) << shift;
+		if ((b & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void encodeZeroRuns(std::vector<char> const& in, std::vector<char>& out) {
+	out.clear();
+	size_t i = 0;
+	while (i < in.size()) {
+		size_t zeros = i;
+		while (zeros < in.size() && in[zeros] == 0) {
+			zeros++;
+		}
+		// A literal run ends at the first stretch of zeros worth a run of its own
+		size_t literal = zeros;
+		while (literal < in.size() && !(in[literal] == 0 && literal + 2 < in.size() && in[literal + 1] == 0 && in[literal + 2] == 0)) {
+			literal++;
+		}
+		putVarint(out, zeros - i);
+		putVarint(out, literal - zeros);
+		out.insert(out.end(), in.begin() + zeros, in.begin() + literal);
+		i = literal;
+	}
+}
+
+bool decodeZeroRuns(char const* p, char const* end, std::vector<char>& out, size_t decodedSize) {
+	out.assign(decodedSize, 0);
+	size_t o = 0;
+	while (p < end) {
+		uint64_t zeros;
+		uint64_t literal;
+		if (!getVarint(p, end, zeros) || !getVarint(p, end, literal) || o + zeros + literal > decodedSize || (uint64_t)(end - p) < literal) {
+			return false;
+		}
+		o += zeros;
+		memcpy(out.data() + o, p, literal);
+		o += literal;
+		p += literal;
+	}
+	return o == decodedSize;
+}
+
+template<typename T>
+void putRaw(std::vector<char>& out, T const& value) {
+	char const* p = (char const*)&value;
+	out.insert(out.end(), p, p + sizeof(T));
+}
+
+template<typename T>
+bool getRaw(char const*& p, char const* end, T& value) {
+	if ((size_t)(end - p) < sizeof(T)) {
+		return false;
+	}
+	memcpy(&value, p, sizeof(T));
+	p += sizeof(T);
+	return true;
+}
+
+struct Recorder {
+	FILE* file;
+	size_t frame;
+	Tick since; // Changes from this tick on are not recorded yet
+	// The world as of the last recorded frame
+	std::vector<EntityId> ids;
+	std::vector<Tag> signatures;
+	EntityIndexList freeList;
+	std::vector<RecordingLink> links;
+	std::vector<std::vector<char>> columns; // Indexed by component id
+	std::vector<bool> described;
+	std::vector<RecordingLink> currentLinks;
+	std::vector<char> payload;
+	std::vector<char> encoded;
+	size_t bytes; // Written so far
+
+	Recorder(std::string const& path, uint64_t seed) : frame(0), since(0), bytes(0) {
+		file = fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			perror("Recorder fopen");
+			return;
+		}
+		RecordingHeader header{};
+		memcpy(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+		header.seed = seed;
+		header.signatureWords = Tag::WORDS;
+		bytes += fwrite(&header, 1, sizeof(header), file);
+	}
+
+	~Recorder() {
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+
+	// Appends the state of the world at the end of a frame, call once every frame from the simulation's thread.
+	// The parent links of the hierarchy are recorded when one is given.
+	void record(Entities& entities, Components& components, Hierarchy const* hierarchy = nullptr) {
+		if (file == nullptr) {
+			return;
+		}
+		ProfileScope scope("record", "frame");
+		bool keyframe = frame % KEYFRAME_INTERVAL == 0;
+		Tick now = components.advance();
+		EntityList const& list = entities.list();
+
+		std::vector<SnapshotComponent> schema;
+		described.resize(components.componentSizes.size(), false);
+		columns.resize(components.componentSizes.size());
+		{
+			std::lock_guard<std::mutex> lock(componentInfosMutex);
+			for(ComponentId i = 0; i < components.componentSizes.size(); i++) {
+				if (components.componentSizes[i] > 0 && !described[i]) {
+					SnapshotComponent c{};
+					strncpy(c.name, componentInfos[i].name.c_str(), sizeof(c.name) - 1);
+					c.size = components.componentSizes[i];
+					c.id = i;
+					schema.push_back(c);
+					described[i] = true;
+				}
+			}
+		}
+
+		payload.clear();
+		putRaw(payload, entities.random.state);
+		// A removed slot at the end looks as if never written, so the length is not left to the changes
+		putRaw(payload, uint64_t(list.size()));
+		// Entities whose id or signature changed
+		if (keyframe) {
+			ids.clear();
+			signatures.clear();
+			for(std::vector<char>& column : columns) {
+				column.clear();
+			}
+		}
+		size_t countAt = payload.size();
+		putRaw(payload, uint64_t(0));
+		uint64_t changedEntities = 0;
+		ids.resize(list.size(), INVALID_ENTITY_ID);
+		signatures.resize(list.size(), 0);
+		for(EntityIndex i = 0; i < list.size(); i++) {
+			Entity const& e = list[i];
+			Tag signature = e.isValid() ? e.components : Tag(0);
+			if (keyframe || e.id != ids[i] || signature != signatures[i]) {
+				putRaw(payload, RecordingEntity{i, SnapshotEntity{e.id.index, e.id.version, 0}, signature});
+				changedEntities++;
+				ids[i] = e.id;
+				signatures[i] = signature;
+			}
+		}
+		memcpy(&payload[countAt], &changedEntities, sizeof(uint64_t));
+
+		EntityIndexList const& currentFree = entities.freeList();
+		if (keyframe || currentFree != freeList) {
+			freeList = currentFree;
+			putRaw(payload, uint64_t(freeList.size()));
+			for(EntityIndex i : freeList) {
+				putRaw(payload, uint64_t(i));
+			}
+		} else {
+			putRaw(payload, FREE_LIST_UNCHANGED);
+		}
+
+		currentLinks.clear();
+		if (hierarchy != nullptr) {
+			for(Hierarchy::Link const& link : hierarchy->links) {
+				if (link.child.isValid()) {
+					currentLinks.push_back(RecordingLink{SnapshotEntity{link.child.index, link.child.version, 0}, SnapshotEntity{link.parent.index, link.parent.version, 0}});
+				}
+			}
+		}
+		if (keyframe || currentLinks != links) {
+			links.swap(currentLinks);
+			putRaw(payload, uint64_t(links.size()));
+			for(RecordingLink const& link : links) {
+				putRaw(payload, link);
+			}
+		} else {
+			putRaw(payload, LINKS_UNCHANGED);
+		}
+
+		countAt = payload.size();
+		putRaw(payload, uint64_t(0));
+		uint64_t changedComponents = 0;
+		for(ComponentId c = 0; c < components.componentSizes.size(); c++) {
+			if (components.componentSizes[c] > 0 && recordComponent(components, list, c, keyframe)) {
+				changedComponents++;
+			}
+		}
+		memcpy(&payload[countAt], &changedComponents, sizeof(uint64_t));
+
+		encodeZeroRuns(payload, encoded);
+		RecordingFrame header{frame, keyframe, schema.size(), encoded.size(), payload.size()};
+		bytes += fwrite(&header, 1, sizeof(header), file);
+		if (!schema.empty()) {
+			bytes += fwrite(schema.data(), 1, schema.size() * sizeof(SnapshotComponent), file);
+		}
+		bytes += fwrite(encoded.data(), 1, encoded.size(), file);
+		fflush(file);
+		since = now;
+		frame++;
+	}
+
+private:
+	// Writes the component's slots that differ from the shadow, returns false and writes nothing if there are none.
+	// Only the slots whose tick says they may have changed are compared, every slot on keyframes.
+	bool recordComponent(Components& components, EntityList const& list, ComponentId c, bool keyframe) {
+		size_t size = components.componentSizes[c];
+		std::vector<char>& column = columns[c];
+		if (column.size() < list.size() * size) {
+			column.resize(list.size() * size, 0);
+		}
+		size_t headerAt = payload.size();
+		putRaw(payload, uint64_t(c));
+		putRaw(payload, uint64_t(0));
+		uint64_t slots = 0;
+		auto visit = [&](EntityIndex i) {
+			char const* value = (char const*)components.raw(list[i], c);
+			char* shadow = &column[i * size];
+			if (memcmp(value, shadow, size) == 0) {
+				return;
+			}
+			putRaw(payload, uint64_t(i));
+			for(size_t b = 0; b < size; b++) {
+				payload.push_back(value[b] ^ shadow[b]);
+			}
+			memcpy(shadow, value, size);
+			slots++;
+		};
+		if (components.storage == Storage::Archetype) {
+			for(auto& [signature, archetype] : components.archetypes) {
+				if (!archetype->has(c)) {
+					continue;
+				}
+				for(size_t chunk = 0; chunk < archetype->chunks.size(); chunk++) {
+					if (!keyframe && archetype->changedTick(c, chunk) < since) {
+						continue;
+					}
+					EntityIndex const* indexes = archetype->entities(chunk);
+					for(size_t row = 0; row < archetype->rows(chunk); row++) {
+						visit(indexes[row]);
+					}
+				}
+			}
+		} else if (components.componentPools[c] != nullptr) {
+			std::vector<Tick> const& ticks = components.changedTicks[c];
+			for(EntityIndex i = 0; i < std::min(ticks.size(), list.size()); i++) {
+				if (list[i].isValid() && list[i].components.test(c) && (keyframe || ticks[i] >= since)) {
+					visit(i);
+				}
+			}
+		}
+		if (slots == 0) {
+			payload.resize(headerAt);
+			return false;
+		}
+		memcpy(&payload[headerAt + sizeof(uint64_t)], &slots, sizeof(uint64_t));
+		return true;
+	}
+
+	// Disallow copying
+	Recorder(Recorder const& old);
+	Recorder& operator=(Recorder const& other);
+};
+
+std::ostream &operator<<(std::ostream &os, Recorder const& m) { return os << ANSI_FG_GREEN << "Recorder{" << m.frame << " frames " << static_cast<float>(m.bytes) / 1000000 << "MB}" << ANSI_RESET; }
+
+// Reads a recording and rebuilds the world at any of its frames
+struct Replay {
+	struct Frame {
+		long offset; // Of the encoded payload
+		RecordingFrame header;
+	};
+
+	RecordingHeader header;
+	std::vector<Frame> frames;
+	std::vector<SnapshotComponent> schema; // Indexed by the recorded id, size 0 where unknown
+	std::vector<ComponentId> ids; // Recorded id to that of this process
+	FILE* file;
+
+	Replay() : header{}, file(nullptr) {}
+
+	~Replay() {
+		if (file != nullptr) {
+			fclose(file);
+		}
+	}
+
+	// Reads the frame headers and registers the recorded components, a frame cut short at the end is left out
+	bool open(std::string const& path) {
+		file = fopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			perror("Replay fopen");
+			return false;
+		}
+		if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0) {
+			fprintf(stderr, "Replay %s: not a recording\n", path.c_str());
+			return false;
+		}
+		if (header.signatureWords != Tag::WORDS) {
+			fprintf(stderr, "Replay %s: recorded with other signatures, set ECS_SIGNATURE_BITS to %zu\n", path.c_str(), (size_t)header.signatureWords * 64);
+			return false;
+		}
+		Frame f;
+		while (fread(&f.header, sizeof(f.header), 1, file) == 1) {
+			for(uint64_t i = 0; i < f.header.newComponents; i++) {
+				SnapshotComponent c;
+				if (fread(&c, sizeof(c), 1, file) != 1 || c.id >= Tag::BITS) {
+					return true;
+				}
+				if (schema.size() <= c.id) {
+					schema.resize(c.id + 1, SnapshotComponent{});
+					ids.resize(c.id + 1, INVALID_COMPONENT_ID);
+				}
+				schema[c.id] = c;
+				ids[c.id] = registerComponent(std::string(c.name, strnlen(c.name, sizeof(c.name))), c.size);
+			}
+			f.offset = ftell(file);
+			if (fseek(file, f.header.payloadSize, SEEK_CUR) != 0) {
+				break;
+			}
+			frames.push_back(f);
+		}
+		// The last payload may be cut short
+		fseek(file, 0, SEEK_END);
+		if (!frames.empty() && frames.back().offset + (long)frames.back().header.payloadSize > ftell(file)) {
+			frames.pop_back();
+		}
+		return true;
+	}
+
+	// Rebuilds the world at the end of the frame into empty entities and components, the components count as
+	// added at the current tick and the world's generator continues from where it was. The recorded parent links
+	// are attached in the hierarchy when one is given.
+	bool load(size_t frame, Entities& entities, Components& components, Hierarchy* hierarchy = nullptr) {
+		ProfileScope scope("replay", "structural");
+		if (frame >= frames.size() || entities.size() != 0) {
+			return false;
+		}
+		size_t start = frame;
+		while (!frames[start].header.keyframe) {
+			start--;
+		}
+		std::vector<EntityId> list;
+		std::vector<Tag> signatures;
+		EntityIndexList freeList;
+		std::vector<RecordingLink> links;
+		std::vector<std::vector<char>> columns(schema.size());
+		uint64_t randomState = 0;
+		std::vector<char> encoded;
+		std::vector<char> payload;
+		for(size_t f = start; f <= frame; f++) {
+			Frame const& fr = frames[f];
+			encoded.resize(fr.header.payloadSize);
+			if (fseek(file, fr.offset, SEEK_SET) != 0 || fread(encoded.data(), 1, encoded.size(), file) != encoded.size()
+				|| !decodeZeroRuns(encoded.data(), encoded.data() + encoded.size(), payload, fr.header.decodedSize)
+				|| !apply(payload, list, signatures, freeList, links, columns, randomState)) {
+				fprintf(stderr, "Replay: frame %zu is corrupt\n", f);
+				return false;
+			}
+		}
+
+		EntityList restored;
+		restored.reserve(list.size());
+		for(EntityIndex i = 0; i < list.size(); i++) {
+			Entity e(list[i]);
+			if (e.isValid()) {
+				for(size_t c = signatures[i].next(0); c < Tag::BITS; c = signatures[i].next(c + 1)) {
+					e.components |= Tag::bit(ids[c]);
+				}
+			}
+			restored.push_back(e);
+		}
+		entities.restore(std::move(restored), std::move(freeList));
+		entities.random.state = randomState;
+		std::vector<char const*> values(COMPONENT_ID, nullptr);
+		for(ComponentId c = 0; c < schema.size(); c++) {
+			if (schema[c].size > 0) {
+				components.prepare(ids[c], std::string(schema[c].name, strnlen(schema[c].name, sizeof(schema[c].name))), schema[c].size);
+				// Slots only ever zero were never written
+				columns[c].resize(list.size() * schema[c].size, 0);
+			}
+		}
+		for(EntityIndex i = 0; i < list.size(); i++) {
+			if (!list[i].isValid()) {
+				continue;
+			}
+			for(size_t c = signatures[i].next(0); c < Tag::BITS; c = signatures[i].next(c + 1)) {
+				values[ids[c]] = columns[c].data() + i * schema[c].size;
+			}
+			components.restore(*entities.find(list[i]), values);
+		}
+		if (hierarchy != nullptr) {
+			for(RecordingLink const& link : links) {
+				hierarchy->attach(EntityId{link.child.index, link.child.version}, EntityId{link.parent.index, link.parent.version});
+			}
+		}
+		LOG_INFO(push, [](std::ostream& os, LogRecord const& r) {
+			os << "Replayed frames " << r.args[0] << " to " << r.args[1] << ", " << r.args[2] << " entities\n";
+		}, start, frame, entities.alive().count);
+		return true;
+	}
+
+private:
+	bool apply(std::vector<char> const& payload, std::vector<EntityId>& list, std::vector<Tag>& signatures, EntityIndexList& freeList, std::vector<RecordingLink>& links, std::vector<std::vector<char>>& columns, uint64_t& randomState) {
+		char const* p = payload.data();
+		char const* end = p + payload.size();
+		uint64_t length;
+		uint64_t count;
+		if (!getRaw(p, end, randomState) || !getRaw(p, end, length) || !getRaw(p, end, count)) {
+			return false;
+		}
+		list.resize(length, INVALID_ENTITY_ID);
+		signatures.resize(length, 0);
+		for(uint64_t k = 0; k < count; k++) {
+			RecordingEntity r;
+			if (!getRaw(p, end, r)) {
+				return false;
+			}
+			if (r.slot >= list.size()) {
+				return false;
+			}
+			list[r.slot] = EntityId{r.id.index, r.id.version};
+			signatures[r.slot] = r.id.index == INVALID_ENTITY_INDEX ? Tag(0) : r.signature;
+			for(size_t c = signatures[r.slot].next(0); c < Tag::BITS; c = signatures[r.slot].next(c + 1)) {
+				if (c >= schema.size() || schema[c].size == 0) {
+					return false;
+				}
+			}
+		}
+		if (!getRaw(p, end, count)) {
+			return false;
+		}
+		if (count != FREE_LIST_UNCHANGED) {
+			freeList.resize(count);
+			for(uint64_t k = 0; k < count; k++) {
+				uint64_t i;
+				if (!getRaw(p, end, i)) {
+					return false;
+				}
+				freeList[k] = i;
+			}
+		}
+		if (!getRaw(p, end, count)) {
+			return false;
+		}
+		if (count != LINKS_UNCHANGED) {
+			links.resize(count);
+			for(uint64_t k = 0; k < count; k++) {
+				if (!getRaw(p, end, links[k])) {
+					return false;
+				}
+			}
+		}
+		if (!getRaw(p, end, count)) {
+			return false;
+		}
+		for(uint64_t k = 0; k < count; k++) {
+			uint64_t c;
+			uint64_t slots;
+			if (!getRaw(p, end, c) || !getRaw(p, end, slots) || c >= schema.size() || schema[c].size == 0) {
+				return false;
+			}
+			size_t size = schema[c].size;
+			std::vector<char>& column = columns[c];
+			for(uint64_t s = 0; s < slots; s++) {
+				uint64_t i;
+				if (!getRaw(p, end, i) || (size_t)(end - p) < size || i >= list.size()) {
+					return false;
+				}
+				if (column.size() < list.size() * size) {
+					column.resize(list.size() * size, 0);
+				}
+				char* slot = &column[i * size];
+				for(size_t b = 0; b < size; b++) {
+					slot[b] ^= p[b];
+				}
+				p += size;
+			}
+		}
+		return p == end;
+	}
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <chrono>
+#include <thread>
+#include "ecs.h"
+
+// Fixed timestep: the wall time between frames accumulates and is spent on simulation steps of equal length, so the
+// simulation advances the same however fast frames come, and the loop waits out the rest of a step.
+
+typedef std::chrono::steady_clock FrameClock;
+
+// Sleeps until shortly before the deadline and spins the rest of the way, sleeps wake up late by up to the margin
+void waitUntil(FrameClock::time_point deadline, std::chrono::nanoseconds spinMargin) {
+	FrameClock::time_point now = FrameClock::now();
+	if (deadline - now > spinMargin) {
+		std::this_thread::sleep_for(deadline - now - spinMargin);
+	}
+	while (FrameClock::now() < deadline) {
+		std::this_thread::yield();
+	}
+}
+
+struct FrameScheduler {
+	Systems& systems;
+	std::chrono::nanoseconds step;
+	size_t maxSteps; // Per frame, time beyond that is dropped instead of making every later frame late too
+	std::chrono::nanoseconds spinMargin;
+	std::chrono::nanoseconds accumulator;
+	FrameClock::time_point last;
+	size_t steps;
+	size_t dropped;
+
+	FrameScheduler(Systems& _systems, std::chrono::nanoseconds _step, size_t _maxSteps = 4) :
+		systems(_systems),
+		step(_step),
+		maxSteps(_maxSteps),
+		spinMargin(std::chrono::milliseconds(1)),
+		accumulator(_step), // The first frame runs a step right away
+		last(FrameClock::now()),
+		steps(0),
+		dropped(0)
+	{}
+
+	// Runs as many steps as the time since the last frame adds up to, returns how many
+	size_t frame(Entities& entities, Components& components) {
+		FrameClock::time_point now = FrameClock::now();
+		accumulator += now - last;
+		last = now;
+		size_t n = 0;
+		while (accumulator >= step && n < maxSteps) {
+			systems.update(entities, components, step);
+			accumulator -= step;
+			n++;
+		}
+		if (accumulator >= step) {
+			size_t behind = accumulator / step;
+			dropped += behind;
+			accumulator -= behind * step;
+			LOG_INFO(push, [](std::ostream& os, LogRecord const& r) {
+				os << ANSI_FG_ORANGE << "Dropped " << r.args[0] << " steps the frame fell behind by" << ANSI_RESET << "\n";
+			}, behind);
+		}
+		steps += n;
+		return n;
+	}
+
+	// When the next step is due
+	FrameClock::time_point deadline() const {
+		return last + (step - accumulator);
+	}
+
+	void wait() {
+		waitUntil(deadline(), spinMargin);
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, FrameScheduler const& m) { return os << ANSI_FG_CYAN << "FrameScheduler{" << m.step.count() / 1000000.0 << "ms " << m.steps << " steps " << m.dropped << " dropped}" << ANSI_RESET; }
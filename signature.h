@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// Define ECS_SIGNATURE_BITS as 64, 128, 256 or 512 to set how many component types a signature can hold
+#ifndef ECS_SIGNATURE_BITS
+#define ECS_SIGNATURE_BITS 128
+#endif
+
+static_assert(ECS_SIGNATURE_BITS == 64 || ECS_SIGNATURE_BITS == 128 || ECS_SIGNATURE_BITS == 256 || ECS_SIGNATURE_BITS == 512, "Signatures are 64, 128, 256 or 512 bits");
+
+// A set of component ids, one bit per id. Converts from an integer holding the lowest 64 bits, so 0 is the
+// empty signature and ~Tag(0) the full one.
+template<size_t Bits>
+struct WideSignature {
+	static const size_t BITS = Bits;
+	static const size_t WORDS = Bits / 64;
+	uint64_t words[WORDS];
+
+	constexpr WideSignature() : words{} {}
+	constexpr WideSignature(uint64_t low) : words{low} {}
+
+	static constexpr WideSignature bit(size_t i) {
+		WideSignature s;
+		s.words[i / 64] = uint64_t(1) << (i % 64);
+		return s;
+	}
+
+	constexpr bool test(size_t i) const {
+		return (words[i / 64] >> (i % 64) & 1) != 0;
+	}
+
+	// The lowest 64 bits, what log records carry
+	constexpr uint64_t low() const {
+		return words[0];
+	}
+
+	// The first set bit at or after i, BITS if there is none
+	size_t next(size_t i) const {
+		for(size_t w = i / 64; w < WORDS; w++) {
+			uint64_t rest = w == i / 64 ? words[w] & (~uint64_t(0) << (i % 64)) : words[w];
+			if (rest != 0) {
+				return w * 64 + __builtin_ctzll(rest);
+			}
+		}
+		return BITS;
+	}
+
+	constexpr explicit operator bool() const {
+		for(size_t w = 0; w < WORDS; w++) {
+			if (words[w] != 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	constexpr WideSignature operator~() const {
+		WideSignature s;
+		for(size_t w = 0; w < WORDS; w++) {
+			s.words[w] = ~words[w];
+		}
+		return s;
+	}
+
+	constexpr WideSignature& operator&=(WideSignature const& other) {
+		for(size_t w = 0; w < WORDS; w++) {
+			words[w] &= other.words[w];
+		}
+		return *this;
+	}
+
+	constexpr WideSignature& operator|=(WideSignature const& other) {
+		for(size_t w = 0; w < WORDS; w++) {
+			words[w] |= other.words[w];
+		}
+		return *this;
+	}
+
+	constexpr WideSignature operator&(WideSignature const& other) const {
+		WideSignature s = *this;
+		return s &= other;
+	}
+
+	constexpr WideSignature operator|(WideSignature const& other) const {
+		WideSignature s = *this;
+		return s |= other;
+	}
+
+	constexpr bool operator==(WideSignature const& other) const {
+		for(size_t w = 0; w < WORDS; w++) {
+			if (words[w] != other.words[w]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	constexpr bool operator!=(WideSignature const& other) const {
+		return !(*this == other);
+	}
+};
+
+template<size_t Bits>
+struct std::hash<WideSignature<Bits>> {
+	size_t operator()(WideSignature<Bits> const& s) const {
+		uint64_t h = 0;
+		for(size_t w = 0; w < WideSignature<Bits>::WORDS; w++) {
+			h = (h ^ s.words[w]) * 0x9E3779B97F4A7C15ull;
+		}
+		return h ^ (h >> 32);
+	}
+};
+
+// One bit per component id
+typedef WideSignature<ECS_SIGNATURE_BITS> Tag;
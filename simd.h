@@ -0,0 +1,172 @@
+#pragma once
+#include <cstring>
+#include <cstddef>
+
+#include "component.h"
+#include "signature.h"
+
+// Kernels over packed Vec3 columns. A column of n Vec3 is 3n contiguous Z, so the kernels treat it as a flat
+// array and apply the per lane mask as a pattern repeating every three vectors.
+
+static_assert(sizeof(Vec3) == 3 * sizeof(Z), "Vec3 columns must be contiguous Z");
+
+// dst[i] += scale * mask * src[i] for every lane of n Vec3
+typedef void (*Vec3Kernel)(Vec3* dst, Vec3 const* src, size_t n, Z scale, Vec3 mask);
+
+inline Z lane(Vec3 const& v, size_t i) {
+	return i == 0 ? v.x : (i == 1 ? v.y : v.z);
+}
+
+void addScaledVec3Scalar(Vec3* dst, Vec3 const* src, size_t n, Z scale, Vec3 mask) {
+	Vec3 m{scale * mask.x, scale * mask.y, scale * mask.z};
+	for(size_t i = 0; i < n; i++) {
+		dst[i].x += m.x * src[i].x;
+		dst[i].y += m.y * src[i].y;
+		dst[i].z += m.z * src[i].z;
+	}
+}
+
+template<size_t Bytes>
+inline __attribute__((always_inline)) void addScaledVec3Vector(Vec3* dst, Vec3 const* src, size_t n, Z scale, Vec3 mask) {
+	typedef Z V __attribute__((vector_size(Bytes)));
+	const size_t W = Bytes / sizeof(Z);
+	Z* d = &dst[0].x;
+	Z const* s = &src[0].x;
+	size_t total = 3 * n;
+	Z pattern[3 * W];
+	for(size_t k = 0; k < 3 * W; k++) {
+		pattern[k] = scale * lane(mask, k % 3);
+	}
+	V m[3];
+	memcpy(m, pattern, sizeof(m));
+	size_t i = 0;
+	for(; i + 3 * W <= total; i += 3 * W) {
+		for(size_t v = 0; v < 3; v++) {
+			V a, b;
+			memcpy(&a, d + i + v * W, Bytes);
+			memcpy(&b, s + i + v * W, Bytes);
+			a += b * m[v];
+			memcpy(d + i + v * W, &a, Bytes);
+		}
+	}
+	for(; i < total; i++) {
+		d[i] += pattern[i % 3] * s[i];
+	}
+}
+
+// Sets bit i of matched, which has a word per 64 signatures, if signature i has every bit of the mask
+typedef void (*SignatureKernel)(Tag const* signatures, size_t n, Tag const& mask, uint64_t* matched);
+
+inline bool hasAll(Tag const& signature, Tag const& mask) {
+	uint64_t missing = 0;
+	for(size_t k = 0; k < Tag::WORDS; k++) {
+		missing |= (signature.words[k] & mask.words[k]) ^ mask.words[k];
+	}
+	return missing == 0;
+}
+
+void matchSignaturesScalar(Tag const* signatures, size_t n, Tag const& mask, uint64_t* matched) {
+	memset(matched, 0, (n + 63) / 64 * sizeof(uint64_t));
+	for(size_t i = 0; i < n; i++) {
+		matched[i / 64] |= uint64_t(hasAll(signatures[i], mask)) << (i % 64);
+	}
+}
+
+// The signatures are one flat array of words, a step covers whole vectors and whole signatures, so either
+// one vector holds several signatures or one signature spans several vectors
+template<size_t Bytes>
+inline __attribute__((always_inline)) void matchSignaturesVector(Tag const* signatures, size_t n, Tag const& mask, uint64_t* matched) {
+	typedef uint64_t V __attribute__((vector_size(Bytes)));
+	const size_t L = Bytes / sizeof(uint64_t);
+	const size_t W = Tag::WORDS;
+	const size_t STEP = L > W ? L : W;
+	const size_t PER_STEP = STEP / W;
+	uint64_t const* s = reinterpret_cast<uint64_t const*>(signatures);
+	uint64_t pattern[STEP];
+	for(size_t k = 0; k < STEP; k++) {
+		pattern[k] = mask.words[k % W];
+	}
+	V m[STEP / L];
+	memcpy(m, pattern, sizeof(m));
+	memset(matched, 0, (n + 63) / 64 * sizeof(uint64_t));
+	size_t i = 0;
+	for(; i + PER_STEP <= n; i += PER_STEP) {
+		uint64_t missing[STEP];
+		for(size_t v = 0; v < STEP / L; v++) {
+			V a;
+			memcpy(&a, s + i * W + v * L, Bytes);
+			a = (a & m[v]) ^ m[v];
+			memcpy(missing + v * L, &a, Bytes);
+		}
+		for(size_t e = 0; e < PER_STEP; e++) {
+			uint64_t any = 0;
+			for(size_t k = 0; k < W; k++) {
+				any |= missing[e * W + k];
+			}
+			matched[(i + e) / 64] |= uint64_t(any == 0) << ((i + e) % 64);
+		}
+	}
+	for(; i < n; i++) {
+		matched[i / 64] |= uint64_t(hasAll(signatures[i], mask)) << (i % 64);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) void matchSignaturesSse(Tag const* signatures, size_t n, Tag const& mask, uint64_t* matched) {
+	matchSignaturesVector<16>(signatures, n, mask, matched);
+}
+
+__attribute__((target("avx2"))) void matchSignaturesAvx2(Tag const* signatures, size_t n, Tag const& mask, uint64_t* matched) {
+	matchSignaturesVector<32>(signatures, n, mask, matched);
+}
+
+__attribute__((target("avx512f"))) void matchSignaturesAvx512(Tag const* signatures, size_t n, Tag const& mask, uint64_t* matched) {
+	matchSignaturesVector<64>(signatures, n, mask, matched);
+}
+
+__attribute__((target("sse2"))) void addScaledVec3Sse(Vec3* dst, Vec3 const* src, size_t n, Z scale, Vec3 mask) {
+	addScaledVec3Vector<16>(dst, src, n, scale, mask);
+}
+
+__attribute__((target("avx2"))) void addScaledVec3Avx2(Vec3* dst, Vec3 const* src, size_t n, Z scale, Vec3 mask) {
+	addScaledVec3Vector<32>(dst, src, n, scale, mask);
+}
+
+__attribute__((target("avx512f"))) void addScaledVec3Avx512(Vec3* dst, Vec3 const* src, size_t n, Z scale, Vec3 mask) {
+	addScaledVec3Vector<64>(dst, src, n, scale, mask);
+}
+#endif
+
+struct SimdKernel {
+	char const* name;
+	Vec3Kernel addScaledVec3;
+	SignatureKernel matchSignatures;
+};
+
+// Picks the widest instruction set the cpu supports, once
+SimdKernel const& simd() {
+	static SimdKernel kernel = [] {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) {
+			return SimdKernel{"avx512", addScaledVec3Avx512, matchSignaturesAvx512};
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			return SimdKernel{"avx2", addScaledVec3Avx2, matchSignaturesAvx2};
+		}
+		if (__builtin_cpu_supports("sse2")) {
+			return SimdKernel{"sse2", addScaledVec3Sse, matchSignaturesSse};
+		}
+#endif
+		return SimdKernel{"scalar", addScaledVec3Scalar, matchSignaturesScalar};
+	}();
+	return kernel;
+}
+
+void addScaledVec3(Vec3* dst, Vec3 const* src, size_t n, Z scale, Vec3 mask) {
+	simd().addScaledVec3(dst, src, n, scale, mask);
+}
+
+void matchSignatures(Tag const* signatures, size_t n, Tag const& mask, uint64_t* matched) {
+	simd().matchSignatures(signatures, n, mask, matched);
+}
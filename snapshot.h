@@ -0,0 +1,318 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "ecs.h"
+#include "hierarchy.h"
+
+// Binary world snapshot: a header with the generator's state, the schema of every component, the entity list with
+// the free list and the signatures, the hierarchy's links, and the slots of every component in pool layout. Component sections are aligned so pool storage maps them as its pools.
+
+const char SNAPSHOT_MAGIC[8] = {'E', 'C', 'S', 'S', 'N', 'A', 'P', '3'};
+const size_t SNAPSHOT_ALIGNMENT = 1 << 16; // A multiple of every page size in use
+
+struct SnapshotHeader {
+	char magic[8];
+	uint64_t componentCount;
+	uint64_t entityCount;
+	uint64_t freeCount;
+	uint64_t entitiesOffset; // Of SnapshotEntity[entityCount]
+	uint64_t freeOffset; // Of uint64_t[freeCount]
+	uint64_t signatureWords; // Of each signature, those of other widths load as long as every saved id fits
+	uint64_t signaturesOffset; // Of uint64_t[entityCount * signatureWords]
+	uint64_t randomState;
+	uint64_t linkCount;
+	uint64_t linksOffset; // Of SnapshotLink[linkCount]
+};
+
+struct SnapshotComponent {
+	char name[32];
+	uint64_t size;
+	uint64_t id; // The bit of the component in the saved signatures
+	uint64_t offset; // Slot i is at offset + i * size
+	uint64_t length;
+};
+
+struct SnapshotEntity {
+	uint64_t index; // INVALID_ENTITY_INDEX once removed
+	uint32_t version;
+	uint32_t reserved;
+};
+
+struct SnapshotLink {
+	SnapshotEntity child;
+	SnapshotEntity parent;
+};
+
+static_assert(sizeof(EntityVersion) <= sizeof(uint32_t), "Versions are saved as 32 bits");
+
+size_t snapshotAlign(size_t offset) {
+	return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+bool snapshotWrite(int fd, void const* data, size_t size, size_t offset) {
+	char const* p = (char const*)data;
+	while (size > 0) {
+		ssize_t written = pwrite(fd, p, size, offset);
+		if (written <= 0) {
+			return false;
+		}
+		p += written;
+		size -= written;
+		offset += written;
+	}
+	return true;
+}
+
+// Writes to a temporary file renamed over path once complete, so worlds mapped from path keep their pages. The
+// parent links of the hierarchy are saved when one is given.
+bool saveSnapshot(std::string const& path, Entities& entities, Components& components, Hierarchy const* hierarchy = nullptr) {
+	ProfileScope scope("saveSnapshot", "structural");
+	EntityList const& list = entities.list();
+	EntityIndexList const& freeList = entities.freeList();
+
+	std::vector<SnapshotComponent> schema;
+	{
+		std::lock_guard<std::mutex> lock(componentInfosMutex);
+		for(ComponentId i = 0; i < components.componentSizes.size(); i++) {
+			if (components.componentSizes[i] == 0) {
+				continue;
+			}
+			SnapshotComponent c{};
+			strncpy(c.name, componentInfos[i].name.c_str(), sizeof(c.name) - 1);
+			c.size = components.componentSizes[i];
+			c.id = i;
+			schema.push_back(c);
+		}
+	}
+
+	std::vector<SnapshotLink> savedLinks;
+	if (hierarchy != nullptr) {
+		for(Hierarchy::Link const& link : hierarchy->links) {
+			if (link.child.isValid()) {
+				savedLinks.push_back(SnapshotLink{SnapshotEntity{link.child.index, link.child.version, 0}, SnapshotEntity{link.parent.index, link.parent.version, 0}});
+			}
+		}
+	}
+
+	SnapshotHeader header{};
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.componentCount = schema.size();
+	header.entityCount = list.size();
+	header.freeCount = freeList.size();
+	header.entitiesOffset = sizeof(SnapshotHeader) + schema.size() * sizeof(SnapshotComponent);
+	header.freeOffset = header.entitiesOffset + list.size() * sizeof(SnapshotEntity);
+	header.signatureWords = Tag::WORDS;
+	header.signaturesOffset = header.freeOffset + freeList.size() * sizeof(uint64_t);
+	header.randomState = entities.random.state;
+	header.linkCount = savedLinks.size();
+	header.linksOffset = header.signaturesOffset + list.size() * sizeof(Tag);
+	size_t end = header.linksOffset + savedLinks.size() * sizeof(SnapshotLink);
+	for(SnapshotComponent& c : schema) {
+		c.offset = snapshotAlign(end);
+		c.length = snapshotAlign(list.size() * c.size);
+		end = c.offset + c.length;
+	}
+
+	std::vector<SnapshotEntity> savedEntities(list.size());
+	std::vector<Tag> savedSignatures(list.size());
+	for(size_t i = 0; i < list.size(); i++) {
+		savedEntities[i] = SnapshotEntity{list[i].id.index, list[i].id.version, 0};
+		savedSignatures[i] = list[i].components;
+	}
+	std::vector<uint64_t> savedFree(freeList.begin(), freeList.end());
+
+	std::string tmp = path + ".tmp";
+	int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("saveSnapshot open");
+		return false;
+	}
+	bool ok = ftruncate(fd, end) == 0
+		&& snapshotWrite(fd, &header, sizeof(header), 0)
+		&& snapshotWrite(fd, schema.data(), schema.size() * sizeof(SnapshotComponent), sizeof(header))
+		&& snapshotWrite(fd, savedEntities.data(), savedEntities.size() * sizeof(SnapshotEntity), header.entitiesOffset)
+		&& snapshotWrite(fd, savedFree.data(), savedFree.size() * sizeof(uint64_t), header.freeOffset)
+		&& snapshotWrite(fd, savedSignatures.data(), savedSignatures.size() * sizeof(Tag), header.signaturesOffset)
+		&& snapshotWrite(fd, savedLinks.data(), savedLinks.size() * sizeof(SnapshotLink), header.linksOffset);
+	for(SnapshotComponent const& c : schema) {
+		if (!ok) {
+			break;
+		}
+		if (components.storage == Storage::Pool) {
+			ComponentPool const& pool = *components.componentPools[c.id];
+			ok = snapshotWrite(fd, pool.data, std::min(c.length, pool.totalSize), c.offset);
+		} else {
+			std::vector<char> slots(c.length, 0);
+			for(Entity const& e : list) {
+				if (e.isValid() && e.components.test(c.id)) {
+					memcpy(&slots[e.id.index * c.size], components.raw(e, c.id), c.size);
+				}
+			}
+			ok = snapshotWrite(fd, slots.data(), slots.size(), c.offset);
+		}
+	}
+	if (close(fd) != 0 || !ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		perror("saveSnapshot write");
+		unlink(tmp.c_str());
+		return false;
+	}
+	LOG_INFO(pushText, [](std::ostream& os, LogRecord const& r) {
+		os << "Saved " << r.args[0] << " entities and " << r.args[1] << " components to " << r.text() << ", " << static_cast<float>(r.args[2]) / 1000000 << "MB\n";
+	}, path, list.size(), schema.size(), end);
+	return true;
+}
+
+// Loads into empty entities and components. In pool storage the pools map the file directly, in archetype storage
+// the components are copied into their archetypes, either way they count as added at the current tick. Component
+// names unknown to this process are given fresh ids, which id<C>() then hands out for the type of that name. The
+// world's generator continues from where it was, and the saved parent links are attached in the hierarchy when
+// one is given.
+bool loadSnapshot(std::string const& path, Entities& entities, Components& components, Hierarchy* hierarchy = nullptr) {
+	ProfileScope scope("loadSnapshot", "structural");
+	if (entities.size() != 0 || !components.archetypes.empty() || std::any_of(components.componentPools.begin(), components.componentPools.end(), [](ComponentPool* p) { return p != nullptr; })) {
+		fprintf(stderr, "loadSnapshot %s: the world is not empty\n", path.c_str());
+		return false;
+	}
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror("loadSnapshot open");
+		return false;
+	}
+	struct stat st;
+	char* file = (char*)MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SnapshotHeader)) {
+		file = (char*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (file == MAP_FAILED) {
+		fprintf(stderr, "loadSnapshot %s: can not map the file\n", path.c_str());
+		close(fd);
+		return false;
+	}
+	size_t fileSize = st.st_size;
+	auto fail = [&](char const* reason) {
+		fprintf(stderr, "loadSnapshot %s: %s\n", path.c_str(), reason);
+		munmap(file, fileSize);
+		close(fd);
+		return false;
+	};
+
+	SnapshotHeader const& header = *(SnapshotHeader const*)file;
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+		return fail("not a snapshot");
+	}
+	if (header.componentCount > Tag::BITS) {
+		return fail("more components than fit in a signature, raise ECS_SIGNATURE_BITS");
+	}
+	if (sizeof(SnapshotHeader) + header.componentCount * sizeof(SnapshotComponent) > fileSize
+		|| header.entitiesOffset + header.entityCount * sizeof(SnapshotEntity) > fileSize
+		|| header.freeOffset + header.freeCount * sizeof(uint64_t) > fileSize
+		|| header.signaturesOffset + header.entityCount * header.signatureWords * sizeof(uint64_t) > fileSize
+		|| header.linksOffset + header.linkCount * sizeof(SnapshotLink) > fileSize) {
+		return fail("truncated");
+	}
+	SnapshotComponent const* schema = (SnapshotComponent const*)(file + sizeof(SnapshotHeader));
+
+	// Saved component bit to the id of this process
+	std::vector<ComponentId> ids(header.signatureWords * 64, INVALID_COMPONENT_ID);
+	for(size_t i = 0; i < header.componentCount; i++) {
+		SnapshotComponent const& c = schema[i];
+		std::string name(c.name, strnlen(c.name, sizeof(c.name)));
+		if (c.id >= ids.size() || c.offset % SNAPSHOT_ALIGNMENT != 0 || c.offset + c.length > fileSize || c.length < header.entityCount * c.size) {
+			return fail("bad component section");
+		}
+		{
+			std::lock_guard<std::mutex> lock(componentInfosMutex);
+			for(ComponentInfo const& info : componentInfos) {
+				if (info.name == name && info.size != c.size) {
+					return fail("component size differs from this build");
+				}
+			}
+		}
+		ids[c.id] = registerComponent(name, c.size);
+	}
+
+	SnapshotEntity const* savedEntities = (SnapshotEntity const*)(file + header.entitiesOffset);
+	uint64_t const* savedSignatures = (uint64_t const*)(file + header.signaturesOffset);
+	EntityList list;
+	list.reserve(header.entityCount);
+	for(size_t i = 0; i < header.entityCount; i++) {
+		SnapshotEntity const& s = savedEntities[i];
+		if (s.index != INVALID_ENTITY_INDEX && s.index != i) {
+			return fail("entity index out of place");
+		}
+		Entity e(EntityId{s.index, s.version});
+		for(size_t w = 0; w < header.signatureWords; w++) {
+			for(uint64_t rest = savedSignatures[i * header.signatureWords + w]; rest != 0; rest &= rest - 1) {
+				ComponentId saved = w * 64 + __builtin_ctzll(rest);
+				if (ids[saved] == INVALID_COMPONENT_ID) {
+					return fail("entity has a component missing from the schema");
+				}
+				e.components |= Tag::bit(ids[saved]);
+			}
+		}
+		list.push_back(e);
+	}
+	uint64_t const* savedFree = (uint64_t const*)(file + header.freeOffset);
+	EntityIndexList freeList(savedFree, savedFree + header.freeCount);
+	entities.restore(std::move(list), std::move(freeList));
+	entities.random.state = header.randomState;
+
+	std::vector<ComponentId> loaded;
+	std::vector<char const*> sections(COMPONENT_ID, nullptr);
+	for(size_t i = 0; i < header.componentCount; i++) {
+		SnapshotComponent const& c = schema[i];
+		ComponentId current = ids[c.id];
+		std::string name(c.name, strnlen(c.name, sizeof(c.name)));
+		loaded.push_back(current);
+		if (components.storage == Storage::Pool) {
+			components.adopt(current, new ComponentPool(name, current, c.size, fd, c.offset, c.length));
+		} else {
+			components.prepare(current, name, c.size);
+			sections[current] = file + c.offset;
+		}
+	}
+
+	EntityList const& restored = entities.list();
+	if (components.storage == Storage::Pool) {
+		// The slots are already in place, acquire them in runs of consecutive entities having the component
+		std::vector<size_t> runs(COMPONENT_ID, 0);
+		for(size_t i = 0; i <= restored.size(); i++) {
+			Tag has = i < restored.size() && restored[i].isValid() ? restored[i].components : 0;
+			for(ComponentId c : loaded) {
+				if (!has.test(c)) {
+					if (i > runs[c]) {
+						components.componentPools[c]->acquireRange(runs[c], i - runs[c]);
+						components.stamp(c, runs[c], i - runs[c]);
+					}
+					runs[c] = i + 1;
+				}
+			}
+		}
+	} else {
+		std::vector<char const*> values(COMPONENT_ID, nullptr);
+		for(EntityIndex i = 0; i < restored.size(); i++) {
+			if (!restored[i].isValid()) {
+				continue;
+			}
+			for(ComponentId c : loaded) {
+				values[c] = sections[c] + i * components.componentSizes[c];
+			}
+			components.restore(*entities.find(restored[i].id), values);
+		}
+	}
+
+	if (hierarchy != nullptr) {
+		SnapshotLink const* savedLinks = (SnapshotLink const*)(file + header.linksOffset);
+		for(size_t i = 0; i < header.linkCount; i++) {
+			SnapshotLink const& link = savedLinks[i];
+			hierarchy->attach(EntityId{link.child.index, link.child.version}, EntityId{link.parent.index, link.parent.version});
+		}
+	}
+
+	LOG_INFO(pushText, [](std::ostream& os, LogRecord const& r) {
+		os << "Loaded " << r.args[0] << " entities and " << r.args[1] << " components from " << r.text() << "\n";
+	}, path, header.entityCount, header.componentCount);
+	munmap(file, fileSize);
+	close(fd);
+	return true;
+}
@@ -0,0 +1,386 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "ecs.h"
+
+// Broadphase for collisions: a uniform grid hashed by cell coordinate. Every entity is listed in each cell its box
+// overlaps and only moves between cell lists when that set of cells changes, so updates cost in proportion to the
+// entities that moved. Candidate pairs are the overlapping boxes sharing a cell.
+
+struct Aabb {
+	Vec3 min;
+	Vec3 max;
+
+	// A box of the size centered on the position
+	static Aabb around(Vec3 const& pos, Vec3 const& size) {
+		return Aabb{{pos.x - size.x / 2, pos.y - size.y / 2, pos.z - size.z / 2}, {pos.x + size.x / 2, pos.y + size.y / 2, pos.z + size.z / 2}};
+	}
+
+	bool overlaps(Aabb const& other) const {
+		// Without short circuits, the outcome is too random to branch on
+		return (min.x <= other.max.x) & (other.min.x <= max.x)
+			& (min.y <= other.max.y) & (other.min.y <= max.y)
+			& (min.z <= other.max.z) & (other.min.z <= max.z);
+	}
+};
+
+struct CollisionPair {
+	EntityIndex a;
+	EntityIndex b;
+};
+
+struct CellCoord {
+	int64_t x, y, z;
+
+	bool operator==(CellCoord const& other) const {
+		return x == other.x && y == other.y && z == other.z;
+	}
+};
+
+const size_t CELL_INLINE_MEMBERS = 4;
+// Cells last found, by hash. A sorted batch enters each cell a few times close together, those lookups are served
+// from here instead of a cold bucket of the table.
+const size_t RECENT_CELLS = 4096;
+// Cell coordinates are clamped to this, so far away boxes share the outermost cells instead of overflowing
+const int64_t CELL_COORD_LIMIT = int64_t(1) << 52;
+
+struct SpatialGrid {
+	// Members carry a copy of their box so the pair query reads each cell as one packed run
+	struct Member {
+		EntityIndex index;
+		Aabb box;
+	};
+
+	// The first few members are stored in place, most cells never need the overflow
+	struct Cell {
+		CellCoord coord;
+		uint32_t count;
+		Member first[CELL_INLINE_MEMBERS];
+		std::vector<Member> more;
+
+		Member& member(size_t i) {
+			return i < CELL_INLINE_MEMBERS ? first[i] : more[i - CELL_INLINE_MEMBERS];
+		}
+
+		Member const& member(size_t i) const {
+			return i < CELL_INLINE_MEMBERS ? first[i] : more[i - CELL_INLINE_MEMBERS];
+		}
+
+		Member& find(EntityIndex index) {
+			size_t i = 0;
+			while (member(i).index != index) {
+				i++;
+			}
+			return member(i);
+		}
+
+		void add(Member const& m) {
+			if (count < CELL_INLINE_MEMBERS) {
+				first[count] = m;
+			} else {
+				more.push_back(m);
+			}
+			count++;
+		}
+
+		void remove(EntityIndex index) {
+			find(index) = member(count - 1);
+			if (count > CELL_INLINE_MEMBERS) {
+				more.pop_back();
+			}
+			count--;
+		}
+	};
+
+	// A position in the table, the high half of the cell's hash tells most other cells apart without reading them
+	struct Bucket {
+		uint32_t tag;
+		uint32_t slot;
+	};
+
+	struct Recent {
+		CellCoord coord;
+		uint32_t slot;
+	};
+
+	// Cells covered by the box of an entity, from first to last inclusive
+	struct Extent {
+		CellCoord first;
+		CellCoord last;
+	};
+
+	Z cellSize;
+	// Cells stay once emptied, so entities moving back and forth do not churn them, until most are empty
+	std::vector<Cell> cells;
+	size_t emptyCells;
+	// Open addressing table from the hash of a cell's coordinates to its position in cells
+	std::vector<Bucket> table;
+	std::vector<Recent> recent;
+	// Indexed by entity index
+	std::vector<EntityId> ids; // INVALID_ENTITY_ID if the entity is not in the grid
+	std::vector<Extent> extents;
+	size_t count;
+
+	explicit SpatialGrid(Z _cellSize) : cellSize(_cellSize), emptyCells(0), table(1024, Bucket{0, EMPTY_SLOT}), recent(RECENT_CELLS, Recent{{0, 0, 0}, EMPTY_SLOT}), count(0) {}
+
+	size_t size() const {
+		return count;
+	}
+
+	bool contains(EntityIndex index) const {
+		return index < ids.size() && ids[index].isValid();
+	}
+
+	CellCoord cellOf(Vec3 const& p) const {
+		return CellCoord{coordOf(p.x), coordOf(p.y), coordOf(p.z)};
+	}
+
+	Extent extentOf(Aabb const& box) const {
+		return Extent{cellOf(box.min), cellOf(box.max)};
+	}
+
+	// Inserts the entity or moves it to its new box
+	void update(EntityId id, Aabb const& box) {
+		place(id, box, extentOf(box));
+	}
+
+	// Same as updating each, with the cells of every box found on the pool's threads first. The boxes are placed
+	// in the order of their first cell, so neighbours follow each other and the cells a box enters were mostly
+	// just visited, or are created next to the last ones, instead of every box landing somewhere cold in the grid.
+	void updateMany(std::vector<std::pair<EntityId, Aabb>> const& batch, ThreadPool& pool = ThreadPool::global()) {
+		std::vector<Extent> batchExtents(batch.size());
+		std::vector<std::pair<uint64_t, uint32_t>> order(batch.size());
+		parallelFor(pool, 0, batch.size(), 4096, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++) {
+				batchExtents[i] = extentOf(batch[i].second);
+				order[i] = {orderKey(batchExtents[i].first), (uint32_t)i};
+			}
+		});
+		std::sort(order.begin(), order.end());
+		// Grown once for as many new cells as there are boxes rather than doubling along the way
+		reserveCells(cells.size() + batch.size());
+		for(auto const& [k, i] : order) {
+			place(batch[i].first, batch[i].second, batchExtents[i]);
+		}
+		if (emptyCells > 1024 && emptyCells > cells.size() / 2) {
+			compact();
+		}
+	}
+
+	void remove(EntityIndex index) {
+		if (!contains(index)) {
+			return;
+		}
+		forEachCell(extents[index], [&](CellCoord c) { leave(c, index); });
+		ids[index] = INVALID_ENTITY_ID;
+		count--;
+	}
+
+	// Removes the entities at the indexes for which gone(EntityId) holds, indexes not in the grid are skipped
+	template<typename F>
+	void prune(EntityIndexList const& indexes, F const& gone) {
+		for(EntityIndex i : indexes) {
+			if (contains(i) && gone(ids[i])) {
+				remove(i);
+			}
+		}
+	}
+
+	// Appends every pair of overlapping boxes, each once. A pair is reported by the cell at the largest first
+	// coordinates of the two extents, which both boxes cover whenever they overlap.
+	void pairs(std::vector<CollisionPair>& out, ThreadPool& pool = ThreadPool::global()) {
+		std::mutex mutex;
+		parallelFor(pool, 0, cells.size(), 16384, [&](size_t begin, size_t end) {
+			std::vector<CollisionPair> local;
+			std::vector<Member> scratch;
+			for(size_t c = begin; c < end; c++) {
+				if (cells[c].count > 1) {
+					pairsIn(cells[c], scratch, local);
+				}
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			out.insert(out.end(), local.begin(), local.end());
+		});
+	}
+
+private:
+	inline static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+	// Cells are centered on the origin, a world laid out flat at z = 0 fills one layer of them rather than two
+	int64_t coordOf(Z v) const {
+		Z c = std::floor(v / cellSize + (Z)0.5);
+		if (c >= (Z)CELL_COORD_LIMIT) {
+			return CELL_COORD_LIMIT;
+		}
+		if (c <= -(Z)CELL_COORD_LIMIT) {
+			return -CELL_COORD_LIMIT;
+		}
+		// NaN lands in the cell at the origin
+		return c == c ? (int64_t)c : 0;
+	}
+
+	// Hash of the coordinates, different cells can share one so a match is confirmed on the cell's coordinates
+	static uint64_t key(CellCoord c) {
+		uint64_t h = (uint64_t)c.x * 0x9E3779B97F4A7C15ull;
+		h = (h ^ (h >> 29) ^ (uint64_t)c.y) * 0xBF58476D1CE4E5B9ull;
+		h = (h ^ (h >> 32) ^ (uint64_t)c.z) * 0x94D049BB133111EBull;
+		return h ^ (h >> 31);
+	}
+
+	// Sorts the cells by x, then y, then z. Coordinates far apart may compare wrongly, which only costs locality.
+	static uint64_t orderKey(CellCoord c) {
+		return ((uint64_t)c.x & 0x1FFFFF) << 42 | ((uint64_t)c.y & 0x1FFFFF) << 21 | ((uint64_t)c.z & 0x1FFFFF);
+	}
+
+	Recent& recentOf(uint64_t k) {
+		return recent[k >> 32 & (RECENT_CELLS - 1)];
+	}
+
+	// Position of the cell in cells, EMPTY_SLOT if it has none
+	uint32_t find(CellCoord c) {
+		uint64_t k = key(c);
+		Recent& r = recentOf(k);
+		if (r.slot != EMPTY_SLOT && r.coord == c) {
+			return r.slot;
+		}
+		uint32_t tag = k >> 32;
+		for(size_t b = k & (table.size() - 1);; b = (b + 1) & (table.size() - 1)) {
+			Bucket const& bucket = table[b];
+			if (bucket.slot == EMPTY_SLOT) {
+				return EMPTY_SLOT;
+			}
+			if (bucket.tag == tag && cells[bucket.slot].coord == c) {
+				r = Recent{c, bucket.slot};
+				return bucket.slot;
+			}
+		}
+	}
+
+	void insertSlot(uint64_t k, uint32_t slot) {
+		size_t b = k & (table.size() - 1);
+		while (table[b].slot != EMPTY_SLOT) {
+			b = (b + 1) & (table.size() - 1);
+		}
+		table[b] = Bucket{uint32_t(k >> 32), slot};
+	}
+
+	// Rebuilds the table with size buckets, a power of two
+	void rehash(size_t size) {
+		table.assign(size, Bucket{0, EMPTY_SLOT});
+		for(uint32_t slot = 0; slot < cells.size(); slot++) {
+			insertSlot(key(cells[slot].coord), slot);
+		}
+	}
+
+	// Makes room for n cells, keeping the table at most half full
+	void reserveCells(size_t n) {
+		if (n > cells.capacity()) {
+			cells.reserve(std::max(n, cells.capacity() * 2));
+		}
+		size_t size = table.size();
+		while (size < n * 2) {
+			size *= 2;
+		}
+		if (size > table.size()) {
+			rehash(size);
+		}
+	}
+
+	// Drops the empty cells
+	void compact() {
+		cells.erase(std::remove_if(cells.begin(), cells.end(), [](Cell const& c) { return c.count == 0; }), cells.end());
+		emptyCells = 0;
+		std::fill(recent.begin(), recent.end(), Recent{{0, 0, 0}, EMPTY_SLOT});
+		size_t size = 1024;
+		while (size < cells.size() * 2) {
+			size *= 2;
+		}
+		rehash(size);
+	}
+
+	template<typename F>
+	static void forEachCell(Extent const& e, F const& fn) {
+		for(int64_t x = e.first.x; x <= e.last.x; x++) {
+			for(int64_t y = e.first.y; y <= e.last.y; y++) {
+				for(int64_t z = e.first.z; z <= e.last.z; z++) {
+					fn(CellCoord{x, y, z});
+				}
+			}
+		}
+	}
+
+	void place(EntityId id, Aabb const& box, Extent const& extent) {
+		EntityIndex index = id.index;
+		if (ids.size() <= index) {
+			ids.resize(index + 1, INVALID_ENTITY_ID);
+			extents.resize(index + 1);
+		}
+		if (contains(index) && ids[index].version != id.version) {
+			remove(index);
+		}
+		if (!contains(index)) {
+			forEachCell(extent, [&](CellCoord c) { enter(c, Member{index, box}); });
+			count++;
+		} else if (!(extents[index].first == extent.first && extents[index].last == extent.last)) {
+			forEachCell(extents[index], [&](CellCoord c) { leave(c, index); });
+			forEachCell(extent, [&](CellCoord c) { enter(c, Member{index, box}); });
+		} else {
+			forEachCell(extent, [&](CellCoord c) { cells[find(c)].find(index).box = box; });
+		}
+		ids[index] = id;
+		extents[index] = extent;
+	}
+
+	void enter(CellCoord c, Member const& m) {
+		uint32_t slot = find(c);
+		if (slot == EMPTY_SLOT) {
+			slot = cells.size();
+			cells.push_back(Cell{c, 0, {}, {}});
+			recentOf(key(c)) = Recent{c, slot};
+			if (cells.size() * 2 > table.size()) {
+				rehash(table.size() * 2);
+			} else {
+				insertSlot(key(c), slot);
+			}
+		} else if (cells[slot].count == 0) {
+			emptyCells--;
+		}
+		cells[slot].add(m);
+	}
+
+	void leave(CellCoord c, EntityIndex index) {
+		Cell& cell = cells[find(c)];
+		cell.remove(index);
+		if (cell.count == 0) {
+			emptyCells++;
+		}
+	}
+
+	// Overflowing cells are copied out first, so the quadratic part runs over one packed array
+	void pairsIn(Cell const& cell, std::vector<Member>& scratch, std::vector<CollisionPair>& out) const {
+		Member const* members = cell.first;
+		if (cell.count > CELL_INLINE_MEMBERS) {
+			scratch.assign(cell.first, cell.first + CELL_INLINE_MEMBERS);
+			scratch.insert(scratch.end(), cell.more.begin(), cell.more.end());
+			members = scratch.data();
+		}
+		for(size_t i = 0; i < cell.count; i++) {
+			Aabb const& a = members[i].box;
+			for(size_t j = i + 1; j < cell.count; j++) {
+				Aabb const& b = members[j].box;
+				if (!a.overlaps(b)) {
+					continue;
+				}
+				Vec3 corner{std::max(a.min.x, b.min.x), std::max(a.min.y, b.min.y), std::max(a.min.z, b.min.z)};
+				if (cellOf(corner) == cell.coord) {
+					out.push_back(CollisionPair{members[i].index, members[j].index});
+				}
+			}
+		}
+	}
+};
+
+std::ostream &operator<<(std::ostream &os, SpatialGrid const& m) { return os << ANSI_FG_GREEN << "SpatialGrid{" << m.size() << " in " << m.cells.size() << " cells of " << m.cellSize << "}" << ANSI_RESET; }
@@ -0,0 +1,186 @@
+#pragma once
+#include "ecs.h"
+#include "spatial.h"
+#include "hierarchy.h"
+#include "framebuffer.h"
+
+struct TrackPositionSystem : System {
+	TrackPositionSystem() : System("TrackPosition", tag<Position>(), tag<Position>(), 0) {}
+
+	void updateAll(Entities& entities, Components& components) override {
+		auto moved = entities.view<Position>(components).changedSince(lastRun);
+		for([[maybe_unused]] auto [e, p] : moved) {
+		}
+	}
+};
+
+void printComponents(Entity& e, Components& components) {
+		if(components.get<Type>(e) != nullptr)         { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Type>(e))         ;}
+		if(components.get<Position>(e) != nullptr)     { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Position>(e))     ;}
+		if(components.get<LocalPosition>(e) != nullptr) { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<LocalPosition>(e)) ;}
+		if(components.get<Velocity>(e) != nullptr)     { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Velocity>(e))     ;}
+		if(components.get<Acceleration>(e) != nullptr) { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Acceleration>(e)) ;}
+		if(components.get<Shape>(e) != nullptr)        { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Shape>(e))        ;}
+		if(components.get<Physical>(e) != nullptr)     { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Physical>(e))     ;}
+		if(components.get<Size>(e) != nullptr)         { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Size>(e))         ;}
+		if(components.get<Brain>(e) != nullptr)        { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Brain>(e))        ;}
+		if(components.get<Inspect>(e) != nullptr)      { std::cout << "\t" << ANSI_FG_MAGENTA << "|" << ANSI_RESET << (*components.get<Inspect>(e))      ;}
+}
+
+// Time-sliced, out of budget it continues from the same row of the query next run
+struct InspectSystem : System {
+	size_t cursor;
+
+	InspectSystem() : System("Inspect", tag<Inspect>(), ~Tag(0), 0), cursor(0) {}
+
+	void updateAll(Entities& entities, Components& components) override {
+		Entities::QueryView matches = entities.matching(signature);
+		EntityIndexList const& indexes = matches.query.indexes;
+		for(; cursor < indexes.size(); cursor++) {
+			if (outOfTime()) {
+				return;
+			}
+			Entity& e = matches.entityList[indexes[cursor]];
+			std::cout << e << " ";
+			printComponents(e, components);
+			std::cout << "\n";
+		}
+		cursor = 0;
+		std::cout << entities << "\n";
+		std::cout << ANSI_FG_CYAN_DARKER << "\n#####################################\n\n" << ANSI_RESET;
+	}
+};
+
+// Movement happens in the xy plane
+const Vec3 PLANAR{1, 1, 0};
+
+static_assert(sizeof(Position) == sizeof(Vec3) && sizeof(Velocity) == sizeof(Vec3) && sizeof(Acceleration) == sizeof(Vec3), "Vec3 components are integrated as packed Vec3 columns");
+
+struct AccelerateSystem : System {
+	AccelerateSystem() : System("Accelerate", tag<Velocity>() | tag<Acceleration>(), tag<Acceleration>(), tag<Velocity>()) {}
+
+	void updateAll(Entities& entities, Components& components) override {
+		entities.view<Velocity, Acceleration>(components).writes(writes, thisRun).parallel_runs([](size_t n, Velocity* v, Acceleration* a) {
+			addScaledVec3(&v->vel, &a->acc, n, 1, PLANAR);
+		});
+	}
+};
+
+struct MoveSystem : System {
+	MoveSystem() : System("Move", tag<Position>() | tag<Velocity>(), tag<Velocity>(), tag<Position>()) {}
+
+	void updateAll(Entities& entities, Components& components) override {
+		entities.view<Position, Velocity>(components).writes(writes, thisRun).parallel_runs([](size_t n, Position* p, Velocity* v) {
+			addScaledVec3(&p->pos, &v->vel, n, 1, PLANAR);
+		});
+	}
+};
+
+// Children follow their parents, entities that lost an ancestor are removed with the rest of the frame's changes
+struct TransformSystem : System {
+	Hierarchy hierarchy;
+
+	TransformSystem() : System("Transform", tag<Position>(), tag<Position>() | tag<LocalPosition>(), tag<Position>()) {}
+
+	void updateAll(Entities& entities, Components& components) override {
+		hierarchy.propagate(entities, components);
+		for(EntityId orphan : hierarchy.orphans) {
+			commands().remove(orphan);
+		}
+		hierarchy.orphans.clear();
+	}
+};
+
+const Z COLLISION_CELL_SIZE = 32;
+
+// Finds the pairs of overlapping entities, the grid only revisits the entities that moved, resized, joined or left
+struct CollisionSystem : System {
+	SpatialGrid grid;
+	std::vector<std::pair<EntityId, Aabb>> moved;
+	std::vector<CollisionPair> pairs;
+	EntityIndexList joined;
+	EntityIndexList left;
+
+	CollisionSystem() : System("Collision", tag<Position>() | tag<Physical>() | tag<Size>(), tag<Position>() | tag<Physical>() | tag<Size>(), 0), grid(COLLISION_CELL_SIZE) {}
+
+	void updateAll(Entities& entities, Components& components) override {
+		// Only the entities that stopped matching since the last run can have gone, and those that started matching
+		// are new to the grid even when their Position and Size are not
+		entities.takeChanges(signature, joined, left);
+		grid.prune(left, [&](EntityId id) {
+			Entity* e = entities.find(id);
+			return e == nullptr || !e->matchesSignature(signature);
+		});
+		moved.clear();
+		EntityList const& list = entities.list();
+		for(EntityIndex i : joined) {
+			if (i >= list.size()) {
+				continue;
+			}
+			Entity const& e = list[i];
+			if (e.isValid() && (e.components & signature) == signature) {
+				moved.push_back({e.id, Aabb::around(components.get<Position>(e)->pos, components.get<Size>(e)->size)});
+			}
+		}
+		entities.view<Position, Physical, Size>(components).changedSince(lastRun, tag<Position>() | tag<Size>()).each([&](Entity& e, Position& p, Physical&, Size& sz) {
+			moved.push_back({e.id, Aabb::around(p.pos, sz.size)});
+		});
+		grid.updateMany(moved);
+		pairs.clear();
+		grid.pairs(pairs);
+		// TODO resolve the collisions
+	}
+};
+
+// Draws every shape into the framebuffer anew each run, it is only memory, what reaches the terminal is the
+// difference TerminalWriter finds against the frame before
+struct RenderSystem : System {
+	Framebuffer framebuffer;
+	size_t drawn;
+
+	RenderSystem() : System("Render", tag<Position>() | tag<Shape>(), tag<Position>() | tag<Shape>(), 0), drawn(0) {}
+
+	void updateAll(Entities& entities, Components& components) override {
+		framebuffer.clear();
+		drawn = 0;
+		entities.view<Position, Shape>(components).each([&](Entity&, Position& p, Shape& sh) {
+			if (framebuffer.plot(p.pos, sh.color)) {
+				drawn++;
+			}
+		});
+	}
+};
+
+void createJesus(CommandBuffer& commands) {
+		static size_t jesusCounter = 0;
+		EntityId ne = commands.create();
+		commands.assign(ne, Type("Jesus", jesusCounter++));
+		commands.assign(ne, Brain(100000));
+}
+
+void createLord(CommandBuffer& commands, Random& random) {
+		static size_t lordCounter = 0;
+		EntityId ne = commands.create();
+		commands.assign(ne, Type("Lord", lordCounter++));
+		commands.assign(ne, Position{0,0,0});
+		commands.assign(ne, Size{10,10,10});
+		commands.assign(ne, Velocity{
+				-50 + 100 * (100 / (1+(float)(random.below(1000)))),
+				-50 + 100 * (100 / (1+(float)(random.below(1000)))),
+				0
+		});
+		commands.assign(ne, Acceleration());
+		commands.assign(ne, Brain(0));
+		commands.assign(ne, Shape{Color{(uint8_t)(55 + random.below(200)), (uint8_t)(55 + random.below(200)), (uint8_t)(55 + random.below(200))}});
+}
+
+// Spawns through the command buffer, so it runs alongside every other system. No other system draws from the
+// world's generator, so the draws stay in the same order.
+struct SpawnSystem : System {
+	SpawnSystem() : System("Spawn", 0, 0, 0) {}
+
+	void updateAll(Entities& entities, [[maybe_unused]] Components& components) override {
+		createLord(commands(), entities.random);
+		createJesus(commands());
+	}
+};
@@ -0,0 +1,402 @@
+#define LOG_LEVEL LOG_LEVEL_OFF
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ecs.h"
+#include "systems.h"
+#include "snapshot.h"
+#include "hierarchy.h"
+#include "recording.h"
+
+// Behavior checks of the ECS, each failure is printed to stderr and the run exits non-zero if there was any
+
+size_t failures = 0;
+
+void check(bool ok, std::string const& what) {
+	if (!ok) {
+		std::cerr << "FAILED " << what << "\n";
+		failures++;
+	}
+}
+
+std::string storageName(Storage storage) {
+	return storage == Storage::Archetype ? "archetype" : "pool";
+}
+
+// The pairs of overlapping boxes, as ordered index pairs
+std::set<std::pair<EntityIndex, EntityIndex>> bruteForcePairs(Entities& entities, Components& components) {
+	std::vector<std::pair<EntityIndex, Aabb>> boxes;
+	entities.view<Position, Physical, Size>(components).each([&](Entity& e, Position& p, Physical&, Size& sz) {
+		boxes.push_back({e.id.index, Aabb::around(p.pos, sz.size)});
+	});
+	std::set<std::pair<EntityIndex, EntityIndex>> pairs;
+	for(size_t i = 0; i < boxes.size(); i++) {
+		for(size_t j = i + 1; j < boxes.size(); j++) {
+			if (boxes[i].second.overlaps(boxes[j].second)) {
+				pairs.insert({std::min(boxes[i].first, boxes[j].first), std::max(boxes[i].first, boxes[j].first)});
+			}
+		}
+	}
+	return pairs;
+}
+
+// Runs the collision system over a world that is created into, moved, given or stripped of Physical and compacted
+// every frame, comparing its pairs with brute force
+void testCollisionPairs(Storage storage) {
+	Entities entities;
+	Components components(storage);
+	CollisionSystem collision;
+	srand(7);
+	auto random = [](Z side) {
+		return side * rand() / RAND_MAX - side / 2;
+	};
+	for(int frame = 0; frame < 100; frame++) {
+		collision.lastRun = collision.thisRun;
+		collision.thisRun = components.advance();
+		for(int i = 0; i < 30; i++) {
+			Entity& e = entities.create();
+			components.assign(e, Position{random(400), random(400), random(frame % 3 == 0 ? 100 : 0)});
+			components.assign(e, Size{Z(1 + rand() % 40), Z(1 + rand() % 40), Z(1 + rand() % 40)});
+			if (rand() % 4 != 0) {
+				components.assign(e, Physical{1});
+			}
+		}
+		for(int i = 0; i < 20 && entities.size() > 0; i++) {
+			Entity& e = entities.getRandom();
+			if (!e.isValid()) {
+				continue;
+			}
+			int action = rand() % 4;
+			if (action == 0) {
+				components.remove(e);
+				entities.remove(e.id);
+			} else if (action == 1 && components.get<Physical>(e) != nullptr) {
+				components.unassign<Physical>(e);
+			} else {
+				components.write<Position>(e)->pos.x += random(100);
+			}
+		}
+		if (frame % 17 == 16) {
+			entities.compact(components);
+		}
+		collision.updateAll(entities, components);
+		std::set<std::pair<EntityIndex, EntityIndex>> found;
+		for(CollisionPair const& pair : collision.pairs) {
+			check(found.insert({std::min(pair.a, pair.b), std::max(pair.a, pair.b)}).second, "collision pair reported twice in " + storageName(storage));
+		}
+		check(found == bruteForcePairs(entities, components), "collision pairs differ from brute force at frame " + std::to_string(frame) + " in " + storageName(storage));
+	}
+}
+
+// An entity that gains or regains Physical without moving or resizing still collides
+void testCollisionJoiners(Storage storage) {
+	Entities entities;
+	Components components(storage);
+	CollisionSystem collision;
+	collision.thisRun = components.advance();
+	Entity& a = entities.create();
+	components.assign(a, Position{0, 0, 0});
+	components.assign(a, Size{10, 10, 10});
+	components.assign(a, Physical{1});
+	Entity& b = entities.create();
+	components.assign(b, Position{1, 1, 1});
+	components.assign(b, Size{10, 10, 10});
+	EntityId joiner = b.id;
+	collision.updateAll(entities, components);
+	check(collision.pairs.empty(), "an entity without Physical collides in " + storageName(storage));
+	for(int round = 0; round < 2; round++) {
+		collision.lastRun = collision.thisRun;
+		collision.thisRun = components.advance();
+		components.assign(*entities.find(joiner), Physical{1});
+		collision.updateAll(entities, components);
+		check(collision.pairs.size() == 1, "an entity that " + std::string(round == 0 ? "gains" : "regains") + " Physical collides in " + storageName(storage));
+		collision.lastRun = collision.thisRun;
+		collision.thisRun = components.advance();
+		components.unassign<Physical>(*entities.find(joiner));
+		collision.updateAll(entities, components);
+		check(collision.pairs.empty(), "an entity that loses Physical stops colliding in " + storageName(storage));
+	}
+}
+
+// Everything a snapshot or a replay has to bring back
+struct CapturedWorld {
+	std::vector<EntityId> ids;
+	std::vector<Tag> signatures;
+	EntityIndexList freeList;
+	uint64_t random;
+	std::map<std::pair<EntityIndex, ComponentId>, std::vector<char>> values;
+	std::vector<std::pair<EntityId, EntityId>> links;
+
+	bool operator==(CapturedWorld const& other) const {
+		return ids == other.ids && signatures == other.signatures && freeList == other.freeList && random == other.random
+			&& values == other.values && links == other.links;
+	}
+};
+
+CapturedWorld capture(Entities& entities, Components& components, Hierarchy const& hierarchy) {
+	CapturedWorld world;
+	world.freeList = entities.freeList();
+	world.random = entities.random.state;
+	for(EntityIndex i = 0; i < entities.list().size(); i++) {
+		Entity const& e = entities.list()[i];
+		world.ids.push_back(e.id);
+		world.signatures.push_back(e.isValid() ? e.components : Tag(0));
+		if (!e.isValid()) {
+			continue;
+		}
+		for(ComponentId c = 0; c < components.componentSizes.size(); c++) {
+			if (e.components.test(c)) {
+				char const* value = (char const*)components.raw(e, c);
+				world.values[{i, c}] = std::vector<char>(value, value + components.componentSizes[c]);
+			}
+		}
+	}
+	for(Hierarchy::Link const& link : hierarchy.links) {
+		if (link.child.isValid()) {
+			world.links.push_back({link.child, link.parent});
+		}
+	}
+	return world;
+}
+
+// Simulates a frame of churn: creations, removals, writes, a new parent link and every 37th frame a compaction
+void churn(Entities& entities, Components& components, Hierarchy& hierarchy, size_t frame) {
+	for(int i = 0; i < 20; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{Z(frame), Z(i), 0});
+		if (i % 3 == 0) {
+			components.assign(e, Velocity{1, 2, 3});
+		}
+		if (i % 5 == 0) {
+			components.assign(e, Size{1, 1, 1});
+		}
+	}
+	for(int i = 0; i < 15 && entities.size() > 0; i++) {
+		Entity& e = entities.getRandom();
+		if (e.isValid()) {
+			components.remove(e);
+			entities.remove(e.id);
+		}
+	}
+	for(int i = 0; i < 5; i++) {
+		Entity& e = entities.getRandom();
+		if (e.isValid() && components.get<Size>(e) != nullptr) {
+			components.write<Size>(e)->size.x += 1;
+		}
+		if (e.isValid() && i == 2) {
+			components.unassign<Velocity>(e);
+		}
+	}
+	if (frame % 37 == 36) {
+		hierarchy.moved(entities.compact(components));
+	}
+	Entity& child = entities.getRandom();
+	Entity& parent = entities.getRandom();
+	if (child.isValid() && parent.isValid()) {
+		hierarchy.attach(child.id, parent.id);
+	}
+	hierarchy.update(entities);
+	hierarchy.orphans.clear();
+}
+
+// Records a churning world and checks that replaying brings back the world of every frame looked at
+void testReplay(Storage storage) {
+	std::string path = "test.record";
+	std::map<size_t, CapturedWorld> recorded;
+	{
+		Entities entities;
+		entities.random.seed(42);
+		Components components(storage);
+		Systems systems;
+		systems.add(new AccelerateSystem);
+		systems.add(new MoveSystem);
+		systems.add(new SpawnSystem);
+		Hierarchy hierarchy;
+		Recorder recorder(path, 42);
+		for(size_t frame = 0; frame < 200; frame++) {
+			churn(entities, components, hierarchy, frame);
+			systems.update(entities, components);
+			recorder.record(entities, components, &hierarchy);
+			// Around the keyframe at 64 and every 13th
+			if (frame % 13 == 0 || (frame >= 63 && frame <= 65) || frame == 199) {
+				recorded[frame] = capture(entities, components, hierarchy);
+			}
+		}
+	}
+	for(auto const& [frame, want] : recorded) {
+		Entities entities;
+		Components components(storage);
+		Hierarchy hierarchy;
+		Replay replay;
+		bool loaded = replay.open(path) && replay.frames.size() == 200 && replay.load(frame, entities, components, &hierarchy);
+		check(loaded, "replay of frame " + std::to_string(frame) + " loads in " + storageName(storage));
+		check(!loaded || capture(entities, components, hierarchy) == want, "replay of frame " + std::to_string(frame) + " matches the recorded world in " + storageName(storage));
+	}
+	unlink(path.c_str());
+}
+
+// Saves a churned world and loads it into each storage
+void testSnapshot(Storage from, Storage to) {
+	std::string path = "test.snapshot";
+	Entities entities;
+	entities.random.seed(7);
+	Components components(from);
+	Hierarchy hierarchy;
+	for(size_t frame = 0; frame < 50; frame++) {
+		churn(entities, components, hierarchy, frame);
+	}
+	CapturedWorld want = capture(entities, components, hierarchy);
+	check(saveSnapshot(path, entities, components, &hierarchy), "snapshot saves from " + storageName(from));
+	Entities loadedEntities;
+	Components loadedComponents(to);
+	Hierarchy loadedHierarchy;
+	bool loaded = loadSnapshot(path, loadedEntities, loadedComponents, &loadedHierarchy);
+	check(loaded, "snapshot loads into " + storageName(to));
+	CapturedWorld got = capture(loadedEntities, loadedComponents, loadedHierarchy);
+	check(!loaded || got == want, "snapshot from " + storageName(from) + " into " + storageName(to) + " matches the saved world");
+	unlink(path.c_str());
+}
+
+// Compaction keeps every living entity's components under its new id and packs them at the start of the list
+void testCompaction(Storage storage) {
+	Entities entities;
+	Components components(storage);
+	std::vector<EntityId> ids;
+	for(int i = 0; i < 1000; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{Z(i), 0, 0});
+		ids.push_back(e.id);
+	}
+	std::map<EntityIndex, Z> expected;
+	for(int i = 0; i < 1000; i++) {
+		if (i % 3 != 0) {
+			Entity* e = entities.find(ids[i]);
+			components.remove(*e);
+			entities.remove(ids[i]);
+		} else {
+			expected[ids[i].index] = Z(i);
+		}
+	}
+	std::vector<EntityMove> moves = entities.compact(components);
+	std::map<EntityIndex, EntityId> to;
+	for(EntityMove const& move : moves) {
+		to[move.from.index] = move.to;
+	}
+	bool packed = entities.alive().count == expected.size();
+	for(EntityIndex i = 0; i < expected.size(); i++) {
+		packed = packed && entities.list()[i].isValid();
+	}
+	check(packed, "compaction packs the living entities at the start of the list in " + storageName(storage));
+	for(auto const& [index, x] : expected) {
+		EntityId id = to.count(index) > 0 ? to[index] : ids[index];
+		Entity* e = entities.find(id);
+		check(e != nullptr && components.get<Position>(*e) != nullptr && components.get<Position>(*e)->pos.x == x, "compaction keeps the components of entity " + std::to_string(index) + " in " + storageName(storage));
+	}
+}
+
+// A link to a removed entity whose index was reused by an entity compaction then moved stays stale, the new
+// entity neither takes the parent's children nor the child's parent
+void testHierarchyStaleAfterReuse(Storage storage) {
+	Entities entities;
+	Components components(storage);
+	Hierarchy hierarchy;
+	std::vector<EntityId> ids;
+	for(int i = 0; i < 8; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{});
+		ids.push_back(e.id);
+	}
+	EntityId root = ids[3], parent = ids[6], child = ids[4], removedChild = ids[7];
+	hierarchy.attach(child, parent);
+	hierarchy.attach(removedChild, root);
+	hierarchy.update(entities);
+	for(EntityId id : {ids[0], ids[1], parent, removedChild}) {
+		components.remove(*entities.find(id));
+		entities.remove(id);
+	}
+	std::vector<EntityId> reused;
+	for(int i = 0; i < 2; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{});
+		reused.push_back(e.id);
+	}
+	bool reuses = (reused[0].index == parent.index || reused[1].index == parent.index) && (reused[0].index == removedChild.index || reused[1].index == removedChild.index);
+	check(reuses, "the removed entities' indexes are reused in " + storageName(storage));
+	std::vector<EntityMove> moves = entities.compact(components);
+	hierarchy.moved(moves);
+	hierarchy.update(entities);
+	std::map<EntityIndex, EntityId> to;
+	for(EntityMove const& move : moves) {
+		to[move.from.index] = move.to;
+	}
+	for(EntityId id : reused) {
+		EntityId now = to.count(id.index) > 0 ? to[id.index] : id;
+		check(to.count(id.index) > 0, "compaction moves the entity reusing index " + std::to_string(id.index) + " in " + storageName(storage));
+		check(!hierarchy.parentOf(now).isValid(), "the entity reusing index " + std::to_string(id.index) + " gets no parent in " + storageName(storage));
+		for(Hierarchy::Link const& link : hierarchy.links) {
+			check(!link.child.isValid() || link.parent != now, "the entity reusing index " + std::to_string(id.index) + " gets no children in " + storageName(storage));
+		}
+	}
+	check(hierarchy.orphans.size() == 1 && hierarchy.orphans[0] == child, "the child of the removed parent is orphaned in " + storageName(storage));
+}
+
+// Entities removed and created through the command buffer every frame reuse the free indexes
+void testChurnReusesIndexes(Storage storage) {
+	Entities entities;
+	Components components(storage);
+	std::vector<EntityId> live;
+	for(int i = 0; i < 100; i++) {
+		Entity& e = entities.create();
+		components.assign(e, Position{});
+		live.push_back(e.id);
+	}
+	for(int frame = 0; frame < 50; frame++) {
+		for(int i = 0; i < 10; i++) {
+			components.remove(*entities.find(live[i]));
+			entities.remove(live[i]);
+		}
+		live.erase(live.begin(), live.begin() + 10);
+		entities.flush();
+		for(int i = 0; i < 5; i++) {
+			Entity& e = entities.create();
+			components.assign(e, Position{});
+			live.push_back(e.id);
+		}
+		CommandBuffer commands;
+		for(int i = 0; i < 5; i++) {
+			EntityId id = entities.reserve();
+			commands.assign(id, Position{});
+			live.push_back(id);
+		}
+		commands.apply(entities, components);
+	}
+	check(entities.list().size() <= 120, "churn keeps the entity list bounded in " + storageName(storage));
+	check(entities.alive().count + entities.freeList().size() == entities.list().size(), "every index is alive or free in " + storageName(storage));
+	for(EntityId id : live) {
+		check(entities.find(id) != nullptr, "churned entity " + std::to_string(id.index) + " is alive in " + storageName(storage));
+	}
+}
+
+int main() {
+	for(Storage storage : {Storage::Pool, Storage::Archetype}) {
+		testCollisionPairs(storage);
+		testCollisionJoiners(storage);
+		testReplay(storage);
+		for(Storage to : {Storage::Pool, Storage::Archetype}) {
+			testSnapshot(storage, to);
+		}
+		testCompaction(storage);
+		testHierarchyStaleAfterReuse(storage);
+		testChurnReusesIndexes(storage);
+	}
+	if (failures > 0) {
+		std::cerr << failures << " checks failed\n";
+		return 1;
+	}
+	std::cerr << "All checks passed\n";
+	return 0;
+}
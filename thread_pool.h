@@ -0,0 +1,160 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// Counts the tasks of a batch that have not finished yet
+struct TaskGroup {
+	std::atomic<size_t> pending;
+	TaskGroup() : pending(0) {}
+};
+
+// Work stealing pool, every worker owns a deque it pushes to and pops from the back of,
+// idle threads steal from the front of the others. Threads outside of the pool share one extra deque.
+struct ThreadPool {
+	struct Task {
+		std::function<void()> fn;
+		TaskGroup* group;
+	};
+
+	struct Queue {
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<Queue> queues;
+	std::atomic<size_t> queued;
+	std::atomic<bool> stopping;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+
+	inline static thread_local ThreadPool* currentPool = nullptr;
+	inline static thread_local size_t currentQueue = 0;
+
+	// The thread calling wait() helps out, so one worker less than there are cores is enough
+	explicit ThreadPool(size_t threads = std::max(1u, std::thread::hardware_concurrency()) - 1) : queues(threads + 1), queued(0), stopping(false) {
+		for(size_t i = 0; i < threads; i++) {
+			workers.emplace_back([this, i] {
+				currentPool = this;
+				currentQueue = i;
+				while (!stopping) {
+					if (!runOne()) {
+						std::unique_lock<std::mutex> lock(sleepMutex);
+						wake.wait_for(lock, std::chrono::milliseconds(1), [this] { return queued > 0 || stopping; });
+					}
+				}
+			});
+		}
+	}
+
+	~ThreadPool() {
+		stopping = true;
+		wake.notify_all();
+		for(std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	// Shared by systems and data parallel loops so nested waits keep every core busy
+	static ThreadPool& global() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	size_t size() const {
+		return workers.size() + 1;
+	}
+
+	// Slot of the calling thread in [0, size()), threads outside of the pool share the last one
+	size_t index() const {
+		return self();
+	}
+
+	void run(TaskGroup& group, std::function<void()> fn) {
+		group.pending++;
+		Queue& q = queues[self()];
+		{
+			std::lock_guard<std::mutex> lock(q.mutex);
+			q.tasks.push_back(Task{std::move(fn), &group});
+		}
+		queued++;
+		wake.notify_one();
+	}
+
+	// Runs queued tasks until every task of the group has finished
+	void wait(TaskGroup& group) {
+		while (group.pending > 0) {
+			if (!runOne()) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+private:
+	size_t self() const {
+		return currentPool == this ? currentQueue : workers.size();
+	}
+
+	bool pop(Queue& q, bool back, Task& task) {
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.tasks.empty()) {
+			return false;
+		}
+		if (back) {
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		} else {
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
+		return true;
+	}
+
+	bool runOne() {
+		if (queued == 0) {
+			return false;
+		}
+		size_t own = self();
+		Task task;
+		bool found = pop(queues[own], true, task);
+		for(size_t i = 1; !found && i < queues.size(); i++) {
+			found = pop(queues[(own + i) % queues.size()], false, task);
+		}
+		if (!found) {
+			return false;
+		}
+		queued--;
+		task.fn();
+		task.group->pending--;
+		return true;
+	}
+
+	ThreadPool(ThreadPool const& old);
+	ThreadPool& operator=(ThreadPool const& other);
+};
+
+// Calls fn(begin, end) over disjoint ranges of at most grainSize covering [begin, end).
+// Ranges are split in halves so thieves take large pieces and the owner keeps working on the small ones.
+template<typename F>
+void parallelFor(ThreadPool& pool, size_t begin, size_t end, size_t grainSize, F const& fn) {
+	TaskGroup group;
+	std::function<void(size_t, size_t)> split = [&](size_t b, size_t e) {
+		while (e - b > grainSize) {
+			size_t mid = b + (e - b) / 2;
+			pool.run(group, [&split, mid, e] { split(mid, e); });
+			e = mid;
+		}
+		fn(b, e);
+	};
+	if (begin < end) {
+		split(begin, end);
+	}
+	pool.wait(group);
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include "ecs.h"
+
+// A world whose component types are fixed at compile time. Each component's id is its position in the type list,
+// so ids and signatures are constants that stay the same across builds and runs, and every component has a pool
+// of its own type. Unlike Components it keeps no change ticks and has no archetype storage.
+
+template<typename C, typename... Cs>
+constexpr ComponentId componentIndex() {
+	constexpr bool matches[] = {std::is_same_v<C, Cs>...};
+	for(ComponentId i = 0; i < sizeof...(Cs); i++) {
+		if (matches[i]) {
+			return i;
+		}
+	}
+	return INVALID_COMPONENT_ID;
+}
+
+// Pool storage holding components of one type, the slots are constructed on assign and destroyed on release
+template<typename Component>
+struct TypedPool {
+	ComponentPool pool;
+	Component* slots;
+
+	explicit TypedPool(ComponentId id) : pool(Component::NAME, id, sizeof(Component)), slots(reinterpret_cast<Component*>(pool.data)) {}
+
+	Component* data() {
+		return slots;
+	}
+
+	Component& operator[](EntityIndex i) {
+		return slots[i];
+	}
+
+	Component* acquire(EntityIndex i, Component const& init) {
+		pool.acquire(i);
+		// Growing may have moved the reservation
+		slots = reinterpret_cast<Component*>(pool.data);
+		return new (&slots[i]) Component(init);
+	}
+
+	void release(EntityIndex i) {
+		slots[i].~Component();
+		pool.release(i);
+	}
+};
+
+template<typename... Cs>
+struct World {
+	static_assert(sizeof...(Cs) <= Tag::BITS, "A signature has one bit per component of the world, raise ECS_SIGNATURE_BITS");
+
+	template<typename C>
+	static constexpr ComponentId index = componentIndex<C, Cs...>();
+
+	template<typename... Qs>
+	static constexpr Tag signature = (Tag::bit(index<Qs>) | ... | Tag(0));
+
+	Entities entities;
+	std::tuple<TypedPool<Cs>...> pools;
+
+	World() : pools(index<Cs>...) {}
+
+	~World() {
+		for(EntityIndex i = entities.alive().next(0); i != INVALID_ENTITY_INDEX; i = entities.alive().next(i + 1)) {
+			release(entities.list()[i]);
+		}
+	}
+
+	// Name and size of each component in id order, what snapshots and tools key components by
+	static std::array<ComponentInfo, sizeof...(Cs)> schema() {
+		return {ComponentInfo{Cs::NAME, sizeof(Cs)}...};
+	}
+
+	template<typename C>
+	TypedPool<C>& pool() {
+		static_assert(index<C> != INVALID_COMPONENT_ID, "The component is not part of the world");
+		return std::get<TypedPool<C>>(pools);
+	}
+
+	Entity& create() {
+		return entities.create();
+	}
+
+	// Removes the entity and destroys its components
+	void remove(EntityId id) {
+		Entity* e = entities.find(id);
+		if (e == nullptr) {
+			return;
+		}
+		release(*e);
+		entities.remove(id);
+	}
+
+	template<typename C>
+	C* assign(Entity& entity, C const& init) {
+		ProfileScope scope("assign", "structural");
+		profileVisit(1, sizeof(C));
+		if (has<C>(entity)) {
+			return &(pool<C>()[entity.id.index] = init);
+		}
+		C* cp = pool<C>().acquire(entity.id.index, init);
+		entity.components |= signature<C>;
+		entity.changed();
+		logAssign(*cp, entity);
+		return cp;
+	}
+
+	template<typename C>
+	void unassign(Entity& entity) {
+		ProfileScope scope("unassign", "structural");
+		profileVisit(1, 0);
+		if (has<C>(entity)) {
+			pool<C>().release(entity.id.index);
+			entity.components &= ~signature<C>;
+			entity.changed();
+		}
+	}
+
+	template<typename C>
+	bool has(Entity const& entity) const {
+		return (entity.components & signature<C>) != 0;
+	}
+
+	template<typename C>
+	C* get(Entity const& entity) {
+		return has<C>(entity) ? &pool<C>()[entity.id.index] : nullptr;
+	}
+
+	// Calls fn(Entity&, Qs&...) for every entity having all of Qs, driven by the registered query for their
+	// signature, each component read straight out of its pool
+	template<typename... Qs, typename F>
+	void each(F&& fn) {
+		Entities::QueryView matches = entities.matching(signature<Qs...>);
+		profileVisit(0, matches.query.size() * (sizeof(Qs) + ...));
+		std::tuple<Qs*...> bases(pool<Qs>().data()...);
+		for(EntityIndex i : matches.query.indexes) {
+			fn(matches.entityList[i], std::get<Qs*>(bases)[i]...);
+		}
+	}
+
+	// Like each() but spread over the pool's threads, entities are handed out in disjoint ranges of grainSize
+	template<typename... Qs, typename F>
+	void parallel_each(F const& fn, size_t grainSize = 1024, ThreadPool& threads = ThreadPool::global()) {
+		Entities::QueryView matches = entities.matching(signature<Qs...>);
+		profileVisit(0, matches.query.size() * (sizeof(Qs) + ...));
+		std::tuple<Qs*...> bases(pool<Qs>().data()...);
+		parallelFor(threads, 0, matches.query.size(), grainSize, [&](size_t begin, size_t end) {
+			for(size_t row = begin; row < end; row++) {
+				EntityIndex i = matches.query.indexes[row];
+				fn(matches.entityList[i], std::get<Qs*>(bases)[i]...);
+			}
+		});
+	}
+
+private:
+	void release(Entity const& entity) {
+		(releaseIfHas<Cs>(entity), ...);
+	}
+
+	template<typename C>
+	void releaseIfHas(Entity const& entity) {
+		if (has<C>(entity)) {
+			pool<C>().release(entity.id.index);
+		}
+	}
+
+	World(World const& old);
+	World& operator=(World const& other);
+};
+
+template<typename... Cs>
+std::ostream &operator<<(std::ostream &os, World<Cs...> const& m) { return os << ANSI_FG_PINK << "World{" << sizeof...(Cs) << " components " << m.entities.alive().count << " entities}" << ANSI_RESET; }